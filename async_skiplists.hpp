@@ -0,0 +1,223 @@
+#ifndef _ASYNC_SKIP_LISTS_HPP
+#define _ASYNC_SKIP_LISTS_HPP
+
+#if __cplusplus < 202002L
+#error "async_skiplists.hpp needs C++20 coroutines, build with -std=c++20"
+#endif
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <utility>
+
+#include "skiplists.hpp"
+
+
+class SkipListsScheduler;
+
+template<typename T>
+struct SkipListsTaskResult {
+    T value;
+
+    void return_value(T v) {
+        value = std::move(v);
+    }
+
+    T result() {
+        return std::move(value);
+    }
+};
+
+template<>
+struct SkipListsTaskResult<void> {
+    void return_void() {
+    }
+
+    void result() {
+    }
+};
+
+
+// A lazy coroutine: it starts when first awaited, or when spawned on a
+// SkipListsScheduler, and when done resumes whoever awaited it. A spawned
+// task is owned by its frame, which frees itself on completion.
+template<typename T>
+class SkipListsTask {
+    public:
+        struct promise_type : SkipListsTaskResult<T> {
+            std::coroutine_handle<> continuation;
+
+            // spawned: no SkipListsTask owns the frame any more
+            bool detached = false;
+
+            SkipListsTask get_return_object() {
+                return SkipListsTask(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+
+            struct FinalAwaiter {
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                    std::coroutine_handle<> next = h.promise().continuation;
+                    if (next) {
+                        return next;
+                    }
+                    if (h.promise().detached) {
+                        h.destroy();
+                    }
+                    return std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept {
+                }
+            };
+
+            FinalAwaiter final_suspend() noexcept {
+                return {};
+            }
+
+            void unhandled_exception() {
+                std::terminate();
+            }
+        };
+
+    private:
+        std::coroutine_handle<promise_type> coro;
+
+        explicit SkipListsTask(std::coroutine_handle<promise_type> h) : coro(h) {
+        }
+
+        friend class SkipListsScheduler;
+
+    public:
+        SkipListsTask(SkipListsTask&& other) noexcept : coro(std::exchange(other.coro, nullptr)) {
+        }
+
+        SkipListsTask(const SkipListsTask&) = delete;
+        SkipListsTask& operator=(const SkipListsTask&) = delete;
+
+        ~SkipListsTask() {
+            if (coro) {
+                coro.destroy();
+            }
+        }
+
+        bool done() const {
+            return coro.done();
+        }
+
+        // co_await runs the task right away and picks up its result
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+            coro.promise().continuation = awaiter;
+            return coro;
+        }
+
+        T await_resume() {
+            return coro.promise().result();
+        }
+};
+
+
+// Round robin over suspended coroutines on one thread. A lookup that is
+// about to touch a node prefetches it and yields, and the scheduler runs
+// the other lookups while the line is on its way.
+class SkipListsScheduler {
+    private:
+        std::deque<std::coroutine_handle<> > ready;
+
+    public:
+        struct Prefetch {
+            SkipListsScheduler* scheduler;
+            const void* addr;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> h) {
+                __builtin_prefetch(addr);
+                scheduler->ready.push_back(h);
+            }
+
+            void await_resume() const noexcept {
+            }
+        };
+
+        // start addr on its way to the cache and let the others run
+        Prefetch prefetch(const void* addr) {
+            return Prefetch{this, addr};
+        }
+
+        // hand the task to the scheduler, its frame goes when it is done
+        void spawn(SkipListsTask<void> task) {
+            task.coro.promise().detached = true;
+            ready.push_back(std::exchange(task.coro, nullptr));
+        }
+
+        // resume until every spawned task has finished
+        void run() {
+            while (!ready.empty()) {
+                std::coroutine_handle<> h = ready.front();
+                ready.pop_front();
+                h.resume();
+            }
+        }
+};
+
+
+template<typename KeyType, typename ValType, bool Expiring>
+struct SkipListsAsync {
+    typedef SkipListsNode<KeyType, ValType, Expiring> Node;
+
+    // SkipLists::search() with a prefetch and a yield before each node is
+    // read: one for the node and its key, one for its forward array once
+    // the search moves onto it. Expired entries are misses but, unlike
+    // find(), are left in place, so a lookup never changes the list under
+    // the others.
+    static SkipListsTask<bool> find(const SkipLists<KeyType, ValType, Expiring>& list, SkipListsScheduler& scheduler,
+                                    KeyType key, ValType& res) {
+        Node* p = list.header;
+        Node* q = list.tail;
+
+        for (int k = list.level - 1; k >= 0; --k) {
+            Node* last = q;
+            while ((q = p->forward[k]) != last) {
+                co_await scheduler.prefetch(q);
+                if (!(q->key < key)) {
+                    break;
+                }
+                p = q;
+                co_await scheduler.prefetch(&p->forward[k]);
+            }
+        }
+
+        if (q != list.tail && q->key == key && !list.expired(q)) {
+            res = q->value;
+            co_return true;
+        }
+
+        co_return false;
+    }
+};
+
+
+// co_await async_find(list, scheduler, key, v) from a coroutine run by
+// scheduler; v must outlive the lookup, and the list must not change
+// while lookups are in flight
+template<typename KeyType, typename ValType, bool Expiring>
+SkipListsTask<bool> async_find(const SkipLists<KeyType, ValType, Expiring>& list, SkipListsScheduler& scheduler,
+                               const KeyType& key, ValType& res) {
+    return SkipListsAsync<KeyType, ValType, Expiring>::find(list, scheduler, key, res);
+}
+
+#endif
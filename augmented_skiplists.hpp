@@ -0,0 +1,315 @@
+#ifndef _AUGMENTED_SKIP_LISTS_HPP
+#define _AUGMENTED_SKIP_LISTS_HPP
+
+#include <vector>
+#include <limits>
+#include <iostream>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "skiplists.hpp"
+
+
+// monoids for AugmentedSkipLists: an identity and an associative combine
+
+template<typename T>
+struct SumMonoid {
+    typedef T value_type;
+
+    static T identity() {
+        return T();
+    }
+
+    static T combine(const T& a, const T& b) {
+        return a + b;
+    }
+};
+
+template<typename T>
+struct MinMonoid {
+    typedef T value_type;
+
+    static T identity() {
+        return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                                    : std::numeric_limits<T>::max();
+    }
+
+    static T combine(const T& a, const T& b) {
+        return b < a ? b : a;
+    }
+};
+
+template<typename T>
+struct MaxMonoid {
+    typedef T value_type;
+
+    static T identity() {
+        return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity()
+                                                    : std::numeric_limits<T>::lowest();
+    }
+
+    static T combine(const T& a, const T& b) {
+        return a < b ? b : a;
+    }
+};
+
+
+template<typename KeyType, typename ValType>
+struct AugmentedSkipListsNode {
+    KeyType key;
+    ValType value;
+
+    std::vector<AugmentedSkipListsNode *> forward;
+
+    // span[k]: the values from this node up to, not including, forward[k]
+    // combined; span[0] is the node's own value
+    std::vector<ValType> span;
+};
+
+
+// Skip lists whose links cache the aggregate of the values they skip, so
+// that aggregate(lo, hi) over any key range takes O(log n) instead of a
+// walk over the range. insert(), remove() and in-place updates refresh the
+// spans of the one node per level that covers the change, bottom up.
+template<typename KeyType, typename ValType, typename Monoid = SumMonoid<ValType> >
+class AugmentedSkipLists {
+    private:
+        typedef AugmentedSkipListsNode<KeyType, ValType> Node;
+
+        // maximum level of this list
+        // level = 0 of the list is empty
+        int level;
+
+        // the upper bound
+        int max_number_of_levels;
+
+        SkipListsLevelGenerator levels;
+
+        // number of elements
+        size_t count;
+
+        // the header holds the identity, the tail is never compared
+        Node* header;
+        Node* tail;
+
+        static int height(const Node* x) {
+            return (int)x->forward.size();
+        }
+
+        // x->span[k] as built from the level below: the spans on level
+        // k-1 from x up to x->forward[k], combined in that order
+        ValType fold(const Node* x, int k) const {
+            if (k == 0) {
+                return x->value;
+            }
+
+            ValType acc = x->span[k-1];
+            for (Node* y = x->forward[k-1]; y != x->forward[k] && y != tail; y = y->forward[k-1]) {
+                acc = Monoid::combine(acc, y->span[k-1]);
+            }
+            return acc;
+        }
+
+        void refresh(Node* x, int k) {
+            x->span[k] = fold(x, k);
+        }
+
+        // see SkipLists::search()
+        Node* search(const KeyType& key, Node** update) const {
+            Node* p = header;
+            Node* q = tail;
+
+            for (int k = level - 1; k >= 0; --k) {
+                Node* last = q;
+                while (q = p->forward[k], q != last && q->key < key) {
+                    p = q;
+                }
+                update[k] = p;
+            }
+
+            return q;
+        }
+
+    public:
+        // ctor
+        AugmentedSkipLists(int max_level_num = 16) :
+            level(0), max_number_of_levels(max_level_num), levels(max_level_num),
+            count(0) {
+                header = new Node();
+                assert(header != NULL);
+                tail = new Node();
+                assert(tail != NULL);
+
+                header->value = Monoid::identity();
+                header->forward.resize(max_number_of_levels, tail);
+                header->span.resize(max_number_of_levels, Monoid::identity());
+        }
+
+        // destructor
+        ~AugmentedSkipLists() {
+            Node* p = header->forward[0];
+            while (p != tail) {
+                Node* next = p->forward[0];
+                delete p;
+                p = next;
+            }
+
+            delete header;
+            delete tail;
+        }
+
+        // see SkipLists::seed_levels()
+        void seed_levels(uint64_t seed) {
+            levels.seed(seed);
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        void print() {
+            for (int i = level - 1; i >= 0; i--) { // for each level
+                for (Node* p = header->forward[i]; p != tail; p = p->forward[i]) {
+                    std::cout << p->key << ":" << p->value << "[" << p->span[i] << "] ";
+                }
+                std::cout << std::endl;
+            }
+        }
+
+        // insert or update in place, either way O(log n) spans change
+        bool insert(const KeyType& key, const ValType& value) {
+            Node* update[max_number_of_levels];
+            Node* q = search(key, update);
+
+            if (q != tail && q->key == key) {
+                q->value = value;
+                // on each level either q or the node before it covers q
+                for (int k = 0; k < level; ++k) {
+                    refresh(k < height(q) ? q : update[k], k);
+                }
+                // insert the same value
+                return false;
+            }
+
+            int h = levels.next();
+            if (h > level) {
+                h = ++level;
+                // update index from 0
+                update[h-1] = header;
+            }
+
+            q = new Node();
+            q->key = key;
+            q->value = value;
+            q->forward.resize(h, tail);
+            q->span.resize(h, value);
+
+            for (int k = 0; k < h; ++k) {
+                q->forward[k] = update[k]->forward[k];
+                update[k]->forward[k] = q;
+            }
+
+            for (int k = 0; k < level; ++k) {
+                if (k < h) {
+                    refresh(q, k);
+                }
+                refresh(update[k], k);
+            }
+
+            ++count;
+
+            return true;
+        }
+
+        bool remove(const KeyType& key) {
+            Node* update[max_number_of_levels];
+            Node* q = search(key, update);
+
+            if (q == tail || !(q->key == key)) {
+                return false;
+            }
+
+            for (int k = 0; k < height(q); ++k) {
+                update[k]->forward[k] = q->forward[k];
+            }
+            delete q;
+
+            for (int k = 0; k < level; ++k) {
+                refresh(update[k], k);
+            }
+
+            while (level > 0 && header->forward[level-1] == tail) {
+                --level;
+            }
+
+            --count;
+
+            return true;
+        }
+
+        bool find(const KeyType& key, ValType& res) {
+            Node* update[max_number_of_levels];
+            Node* q = search(key, update);
+
+            if (q != tail && q->key == key) {
+                res = q->value;
+                return true;
+            }
+
+            return false;
+        }
+
+        // combine the values of all keys in [lo, hi]: from the first key
+        // not below lo, take the widest span still ending at or before hi.
+        // Once a level overshoots hi, no later node in range is that tall,
+        // so the level to try only goes down.
+        ValType aggregate(const KeyType& lo, const KeyType& hi) {
+            Node* update[max_number_of_levels];
+            Node* x = search(lo, update);
+            ValType acc = Monoid::identity();
+
+            int top = level - 1;
+            while (x != tail && !(hi < x->key)) {
+                int k = height(x) - 1;
+                if (k > top) {
+                    k = top;
+                }
+                int tried = k;
+                while (k >= 0 && (x->forward[k] == tail || hi < x->forward[k]->key)) {
+                    --k;
+                }
+                if (k < tried) {
+                    // level k+1 overshot
+                    top = k;
+                }
+
+                if (k < 0) {
+                    // x is the last key in range
+                    acc = Monoid::combine(acc, x->value);
+                    break;
+                }
+
+                acc = Monoid::combine(acc, x->span[k]);
+                x = x->forward[k];
+            }
+
+            return acc;
+        }
+
+        // check bottom up that each span is the fold of the spans below
+        // it; the fold combines in the same order as refresh(), so the
+        // comparison is exact even for floating point sums
+        bool check_invariants() {
+            for (int k = 0; k < level; ++k) {
+                for (Node* p = header; p != tail; p = p->forward[k]) {
+                    if (!(fold(p, k) == p->span[k])) {
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <stdlib.h>
+
+#include "skiplists.hpp"
+#include "concurrent_skiplists.hpp"
+
+#if __cplusplus >= 202002L
+#include "async_skiplists.hpp"
+#endif
+
+using namespace std;
+
+
+// int key that counts how often it is compared
+struct CountedKey {
+    static long comparisons;
+
+    int v;
+
+    CountedKey(int x = 0) : v(x) {}
+
+    bool operator<(const CountedKey& other) const {
+        ++comparisons;
+        return v < other.v;
+    }
+
+    bool operator==(const CountedKey& other) const {
+        ++comparisons;
+        return v == other.v;
+    }
+};
+
+long CountedKey::comparisons = 0;
+
+std::ostream& operator<<(std::ostream& os, const CountedKey& k)
+{
+    return os << k.v;
+}
+
+
+static void report(const char* op, long n, long comparisons, std::chrono::steady_clock::duration elapsed)
+{
+    cout << "  " << op << ": "
+         << (double)comparisons / n << " compares/op, "
+         << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / n << " ns/op" << endl;
+}
+
+
+#if __cplusplus >= 202002L
+
+// one of the lookups in flight: every group-th key from first on
+static SkipListsTask<void> find_worker(const SkipLists<CountedKey, int>& skip_list, SkipListsScheduler& scheduler,
+                                       const std::vector<int>& keys, int first, int group, long* found)
+{
+    for (size_t i = first; i < keys.size(); i += group) {
+        int v = 0;
+        *found += co_await async_find(skip_list, scheduler, CountedKey(keys[i] + (i & 1)), v);
+    }
+}
+
+#endif
+
+static void run(const char* name, SkipListsBalance balance, int n)
+{
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; ++i) {
+        keys[i] = i * 2;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(1));
+
+    SkipLists<CountedKey, int> skip_list(16, balance);
+    cout << name << ", " << n << " keys" << endl;
+
+    CountedKey::comparisons = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) {
+        skip_list.insert(keys[i], i);
+    }
+    report("insert", n, CountedKey::comparisons, std::chrono::steady_clock::now() - start);
+
+    // hits and misses
+    CountedKey::comparisons = 0;
+    start = std::chrono::steady_clock::now();
+    int v = 0;
+    long found = 0;
+    for (int i = 0; i < n; ++i) {
+        found += skip_list.find(keys[i] + (i & 1), v);
+    }
+    report("find", n, CountedKey::comparisons, std::chrono::steady_clock::now() - start);
+    if (found != (n + 1) / 2) {
+        cout << "  unexpected hits: " << found << endl;
+    }
+
+#if __cplusplus >= 202002L
+    // the same lookups, 16 in flight
+    SkipListsScheduler scheduler;
+    CountedKey::comparisons = 0;
+    start = std::chrono::steady_clock::now();
+    found = 0;
+    for (int g = 0; g < 16; ++g) {
+        scheduler.spawn(find_worker(skip_list, scheduler, keys, g, 16, &found));
+    }
+    scheduler.run();
+    report("interleaved find", n, CountedKey::comparisons, std::chrono::steady_clock::now() - start);
+    if (found != (n + 1) / 2) {
+        cout << "  unexpected hits: " << found << endl;
+    }
+#endif
+
+    CountedKey::comparisons = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) {
+        skip_list.remove(keys[i]);
+    }
+    report("remove", n, CountedKey::comparisons, std::chrono::steady_clock::now() - start);
+}
+
+
+// lookups per second from reader threads while one writer keeps
+// replacing and removing keys
+static void run_readers(int n, int readers, int ms)
+{
+    ConcurrentSkipLists<int, int> list;
+    for (int i = 0; i < n; ++i) {
+        list.insert(i * 2, i);
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<long> lookups(0);
+    long writes = 0;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < readers; ++t) {
+        threads.push_back(std::thread([&list, &stop, &lookups, n, t]() {
+            ConcurrentSkipLists<int, int>::Reader reader(list);
+            std::mt19937 rng(t + 1);
+            long done = 0;
+            int v;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 256; ++i) {
+                    reader.find(rng() % (2 * n), v);
+                }
+                done += 256;
+            }
+            lookups.fetch_add(done);
+        }));
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point until = start + std::chrono::milliseconds(ms);
+    std::mt19937 rng(0);
+    while (std::chrono::steady_clock::now() < until) {
+        for (int i = 0; i < 64; ++i) {
+            int k = (rng() % n) * 2;
+            if (rng() & 1) {
+                list.insert(k, i);
+            } else {
+                list.remove(k);
+            }
+        }
+        writes += 64;
+    }
+    stop.store(true);
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    cout << "  " << readers << " readers: "
+         << (long)(lookups.load() / secs) << " lookups/s, "
+         << (long)(writes / secs) << " writes/s" << endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    run("randomized", RANDOMIZED_LEVELS, n);
+    run("deterministic", DETERMINISTIC_LEVELS, n);
+
+    // reader scaling with an active writer, 1/2/4 and one per core
+    cout << "concurrent, " << n << " keys, one writer" << endl;
+    int cores = std::thread::hardware_concurrency();
+    for (int readers = 1; readers <= 4; readers *= 2) {
+        run_readers(n, readers, 500);
+    }
+    if (cores > 4) {
+        run_readers(n, cores, 500);
+    }
+
+    return 0;
+}
@@ -0,0 +1,336 @@
+#ifndef _COMPACT_SKIP_LISTS_HPP
+#define _COMPACT_SKIP_LISTS_HPP
+
+#include <vector>
+#include <iostream>
+#include <type_traits>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "skiplists.hpp"
+
+
+// Skip lists for trivially copyable keys and values.
+//
+// All nodes live in one contiguous slab of 32-bit words and link to each
+// other by word index instead of by pointer. A node is laid out as
+//
+//     [level][key words][value words][forward 0 .. level-1]
+//
+// so CompactSkipLists<int, int> costs 3 + level words per element, about
+// 17 bytes at p = 1/4, against 56+ bytes for a heap node with a
+// std::vector of forward pointers. The header sits at index 0; since no node ever points
+// back to the header, index 0 doubles as NIL.
+template<typename KeyType, typename ValType>
+class CompactSkipLists {
+    static_assert(std::is_trivially_copyable<KeyType>::value,
+                  "CompactSkipLists requires a trivially copyable key type");
+    static_assert(std::is_trivially_copyable<ValType>::value,
+                  "CompactSkipLists requires a trivially copyable value type");
+
+    private:
+        typedef uint32_t word_t;
+
+        static constexpr word_t NIL = 0;
+
+        // words taken by a key/value, rounded up
+        static constexpr int KEY_WORDS = (sizeof(KeyType) + sizeof(word_t) - 1) / sizeof(word_t);
+        static constexpr int VAL_WORDS = (sizeof(ValType) + sizeof(word_t) - 1) / sizeof(word_t);
+
+        // offsets inside a node
+        static constexpr int KEY_OFFSET = 1;
+        static constexpr int VAL_OFFSET = KEY_OFFSET + KEY_WORDS;
+        static constexpr int FORWARD_OFFSET = VAL_OFFSET + VAL_WORDS;
+
+        // maximum level of this list
+        // level = 0 of the list is empty
+        int level;
+
+        // the upper bound
+        int max_number_of_levels;
+
+        SkipListsLevelGenerator levels;
+
+        // number of elements
+        size_t count;
+
+        // all nodes, the header at index 0
+        std::vector<word_t> slab;
+
+        // removed nodes, chained through forward[0], one list per level
+        std::vector<word_t> free_nodes;
+
+        word_t& node_level(word_t n) {
+            return slab[n];
+        }
+
+        word_t& forward(word_t n, int k) {
+            return slab[n + FORWARD_OFFSET + k];
+        }
+
+        KeyType key_of(word_t n) const {
+            KeyType key;
+            memcpy(&key, &slab[n + KEY_OFFSET], sizeof(KeyType));
+            return key;
+        }
+
+        ValType value_of(word_t n) const {
+            ValType value;
+            memcpy(&value, &slab[n + VAL_OFFSET], sizeof(ValType));
+            return value;
+        }
+
+        void set_key(word_t n, const KeyType& key) {
+            memcpy(&slab[n + KEY_OFFSET], &key, sizeof(KeyType));
+        }
+
+        void set_value(word_t n, const ValType& value) {
+            memcpy(&slab[n + VAL_OFFSET], &value, sizeof(ValType));
+        }
+
+        // take a node of level l, from the free list if possible
+        word_t allocate_node(int l) {
+            word_t n = free_nodes[l];
+            if (n != NIL) {
+                free_nodes[l] = forward(n, 0);
+                return n;
+            }
+
+            size_t words = FORWARD_OFFSET + l;
+            if (slab.size() + words > UINT32_MAX) {
+                // out of index space
+                return NIL;
+            }
+
+            n = slab.size();
+            slab.resize(slab.size() + words, NIL);
+            node_level(n) = l;
+            return n;
+        }
+
+        void free_node(word_t n) {
+            int l = node_level(n);
+            forward(n, 0) = free_nodes[l];
+            free_nodes[l] = n;
+        }
+
+        // top-down search shared by find, insert and remove, see
+        // SkipLists::search(); NIL plays the tail, it is never compared
+        word_t search(const KeyType& key, word_t* update) {
+            word_t p = 0;
+            word_t q = NIL;
+
+            for (int k = level - 1; k >= 0; --k) {
+                word_t last = q;
+                while (q = forward(p, k), q != last && key_of(q) < key) {
+                    p = q;
+                }
+                if (update != NULL) {
+                    update[k] = p;
+                }
+            }
+
+            return q;
+        }
+
+    public:
+        // ctor
+        CompactSkipLists(int max_level_num = 16) :
+            level(0), max_number_of_levels(max_level_num), levels(max_level_num),
+            count(0), free_nodes(max_number_of_levels + 1, NIL) {
+                slab.resize(FORWARD_OFFSET + max_number_of_levels, NIL);
+                node_level(0) = max_number_of_levels;
+        }
+
+        // see SkipLists::seed_levels()
+        void seed_levels(uint64_t seed) {
+            levels.seed(seed);
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        // bytes held by this list, slab slack included
+        size_t memory_usage() const {
+            return sizeof(*this) + slab.capacity() * sizeof(word_t)
+                + free_nodes.capacity() * sizeof(word_t);
+        }
+
+        // preallocate room for n more elements of average level
+        void reserve(size_t n) {
+            slab.reserve(slab.size() + n * FORWARD_OFFSET + n * 4 / 3 + 1);
+        }
+
+        void shrink_to_fit() {
+            slab.shrink_to_fit();
+        }
+
+        void print() {
+            for(int i=level-1; i>=0; i--) { // for each level
+                word_t p = forward(0, i);
+
+                while (p != NIL) {
+                    std::cout << key_of(p) << ":" << value_of(p) << " ";
+                    p = forward(p, i);
+                }
+
+                std::cout << std::endl;
+            }
+        }
+
+        bool insert(const KeyType& key, const ValType& value) {
+            int k;
+
+            word_t update[max_number_of_levels];
+            word_t p;
+            word_t q = search(key, update);
+
+            if (q != NIL && key_of(q) == key) {
+                set_value(q, value);
+                // insert the same value
+                return false;
+            }
+
+            k = levels.next();
+            if (k > level) {
+                k = ++level;
+                // update index from 0
+                update[k-1] = 0;
+            }
+            q = allocate_node(k);
+            if (q == NIL) {
+                // out of memory
+                return false;
+            }
+            set_key(q, key);
+            set_value(q, value);
+
+            while ( --k >= 0 ) {
+                p = update[k];
+                forward(q, k) = forward(p, k);
+                forward(p, k) = q;
+            }
+
+            ++count;
+
+            return true;
+        }
+
+        bool remove(const KeyType& key) {
+            word_t update[max_number_of_levels];
+
+            // search first
+            word_t q = search(key, update);
+
+            if (q == NIL || !(key_of(q) == key)) {
+                return false;
+            }
+
+            for(int i=0; (i<level) && (forward(update[i], i) == q); ++i) {
+                forward(update[i], i) = forward(q, i);
+            }
+
+            free_node(q);
+
+            while (level > 0 && forward(0, level-1) == NIL) {
+                --level;
+            }
+
+            --count;
+
+            return true;
+        }
+
+        bool find(const KeyType& key, ValType& res) {
+            word_t q = search(key, NULL);
+
+            if (q != NIL && key_of(q) == key) {
+                res = value_of(q);
+                return true;
+            }
+
+            return false;
+        }
+
+        // the structural checks of SkipLists::check_invariants(): count,
+        // level, every list sorted and a sublist of the one below, and
+        // nodes only on the levels they have
+        bool check_invariants() {
+            size_t nodes = 0;
+            for (word_t p = forward(0, 0); p != NIL; p = forward(p, 0)) {
+                ++nodes;
+            }
+            if (nodes != count) {
+                return false;
+            }
+
+            if (level < 0 || level > max_number_of_levels) {
+                return false;
+            }
+            if (level > 0 && forward(0, level-1) == NIL) {
+                return false;
+            }
+            for (int k = level; k < max_number_of_levels; ++k) {
+                if (forward(0, k) != NIL) {
+                    return false;
+                }
+            }
+
+            for (int k = 0; k < level; ++k) {
+                word_t below = (k > 0) ? forward(0, k-1) : NIL;
+
+                for (word_t p = forward(0, k); p != NIL; p = forward(p, k)) {
+                    if ((int)node_level(p) <= k || (int)node_level(p) > max_number_of_levels) {
+                        return false;
+                    }
+                    if (forward(p, k) != NIL && !(key_of(p) < key_of(forward(p, k)))) {
+                        return false;
+                    }
+
+                    if (k > 0) {
+                        while (below != NIL && below != p) {
+                            if ((int)node_level(below) > k) {
+                                return false;
+                            }
+                            below = forward(below, k-1);
+                        }
+                        if (below == NIL) {
+                            return false;
+                        }
+                        below = forward(below, k-1);
+                    }
+                }
+
+                if (k > 0) {
+                    for (; below != NIL; below = forward(below, k-1)) {
+                        if ((int)node_level(below) > k) {
+                            return false;
+                        }
+                    }
+                }
+            }
+
+            return true;
+        }
+};
+
+
+// Pick CompactSkipLists when both key and value are trivially copyable.
+// The two types share only the constructor's first argument, insert(),
+// find(), remove(), size() and print(); code that also uses balance modes,
+// pop_front(), TTLs, iterators or lower_bound() must name SkipLists.
+template<typename KeyType, typename ValType,
+         bool Compact = std::is_trivially_copyable<KeyType>::value && std::is_trivially_copyable<ValType>::value>
+struct SkipListsFor {
+    typedef SkipLists<KeyType, ValType> type;
+};
+
+template<typename KeyType, typename ValType>
+struct SkipListsFor<KeyType, ValType, true> {
+    typedef CompactSkipLists<KeyType, ValType> type;
+};
+
+#endif
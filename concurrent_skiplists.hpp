@@ -0,0 +1,627 @@
+#ifndef _CONCURRENT_SKIP_LISTS_HPP
+#define _CONCURRENT_SKIP_LISTS_HPP
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "skiplists.hpp"
+
+#define CONCURRENT_SKIPLISTS_MAX_READERS 64
+
+// retired nodes collected before the writer tries to reclaim them
+#define CONCURRENT_SKIPLISTS_RECLAIM_BATCH 64
+
+// ThreadSanitizer does not model atomic_thread_fence(), which orders the
+// epoch announcement against the slot scan; under it both sides use
+// seq_cst accesses instead, which it does follow
+#if defined(__SANITIZE_THREAD__)
+#define CONCURRENT_SKIPLISTS_NO_FENCES
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define CONCURRENT_SKIPLISTS_NO_FENCES
+#endif
+#endif
+
+// popped nodes left linked before the writer or a consumer unlinks them
+// in one go
+#define CONCURRENT_SKIPLISTS_PURGE_BATCH 32
+
+
+// what happened to a published node
+enum ConcurrentSkipListsNodeState {
+    NODE_LIVE,
+
+    // claimed by a consumer through pop_front(), still linked
+    NODE_POPPED,
+
+    // removed or replaced by the writer
+    NODE_UNLINKED
+};
+
+
+template<typename KeyType, typename ValType>
+struct ConcurrentSkipListsNode {
+    KeyType key;
+    ValType value;
+
+    std::atomic<int> state;
+
+    std::vector<std::atomic<ConcurrentSkipListsNode *> > forward;
+
+    ConcurrentSkipListsNode(const KeyType& k, const ValType& v, int height) :
+        key(k), value(v), state(NODE_LIVE), forward(height) {
+    }
+};
+
+
+// Skip lists for one writer thread and any number of reader threads.
+//
+// The writer links a new node bottom level first with release stores, so
+// a reader that reaches it through any level finds a fully built tower.
+// Nodes are never changed once published: insert() on an existing key
+// swaps in a fresh copy, and remove() unlinks the node but leaves its own
+// forward pointers intact so readers standing on it can move on. Readers
+// only ever do acquire loads.
+//
+// Unlinked nodes are freed through epochs. A reader announces the epoch
+// it entered in its slot; the writer bumps the epoch after each unlink and
+// frees a node once no reader is still inside an epoch at or before the
+// one it was retired in.
+//
+// Readers can also consume the list as a priority queue. pop_front()
+// claims a node by moving it from NODE_LIVE to NODE_POPPED, the
+// Lindén-Jonsson logical delete. Once enough nodes are popped, whoever
+// gets the writer lock first, the writer or a consumer, drops the whole
+// popped prefix at once, so pops stay O(1) amortized while the writer is
+// idle. Consumers only try_lock() and never wait for the writer. With
+// several consumers, each starts from a random spot near the head
+// (SprayList), so they seldom fight over the same node. Each pop returns
+// one of the first O(p log p) keys for p consumers, not strictly the
+// smallest.
+template<typename KeyType, typename ValType>
+class ConcurrentSkipLists {
+    private:
+        typedef ConcurrentSkipListsNode<KeyType, ValType> Node;
+
+        // one cache line per reader so announcements do not contend
+        struct alignas(64) ReaderSlot {
+            // epoch the reader entered in, 0 when outside
+            std::atomic<uint64_t> active;
+            std::atomic<bool> used;
+
+            ReaderSlot() : active(0), used(false) {}
+        };
+
+        // maximum level of this list
+        // level = 0 of the list is empty
+        std::atomic<int> level;
+
+        // the upper bound
+        int max_number_of_levels;
+
+        SkipListsLevelGenerator levels;
+
+        // number of elements, writer side
+        size_t count;
+
+        Node* header;
+
+        std::atomic<uint64_t> epoch;
+        std::vector<ReaderSlot> slots;
+
+        // readers that have called pop_front(), the p of the spray
+        std::atomic<int> consumers;
+
+        // nodes claimed by pop_front() and still linked
+        std::atomic<size_t> popped;
+
+        // unlinked nodes and the epoch they were unlinked in
+        std::vector<std::pair<uint64_t, Node*> > retired;
+
+        // held by the writer for every change, and by a consumer that
+        // unlinks the popped prefix
+        mutable std::mutex writer;
+
+        // only the writer frees retired nodes: its own lookups announce no
+        // epoch, so a consumer must not free a node under them
+        void retire(Node* x) {
+            uint64_t e = epoch.load(std::memory_order_relaxed);
+            retired.push_back(std::make_pair(e, x));
+#ifdef CONCURRENT_SKIPLISTS_NO_FENCES
+            epoch.store(e + 1, std::memory_order_seq_cst);
+#else
+            epoch.store(e + 1, std::memory_order_release);
+#endif
+        }
+
+        // writer-side search, fills update[] with the last node before key
+        Node* search(const KeyType& key, Node** update) {
+            Node* p = header;
+            Node* q = NULL;
+
+            int k = level.load(std::memory_order_relaxed);
+            while (--k >= 0) {
+                while (q = p->forward[k].load(std::memory_order_relaxed), q != NULL && q->key < key) {
+                    p = q;
+                }
+                update[k] = p;
+            }
+
+            return q;
+        }
+
+        // first node from n on not popped by a consumer
+        static Node* live(Node* n) {
+            while (n != NULL && n->state.load(std::memory_order_acquire) == NODE_POPPED) {
+                n = n->forward[0].load(std::memory_order_acquire);
+            }
+            return n;
+        }
+
+        // pop the first live node from n on
+        static Node* claim(Node* n) {
+            for (; n != NULL; n = n->forward[0].load(std::memory_order_acquire)) {
+                int expected = NODE_LIVE;
+                if (n->state.load(std::memory_order_relaxed) == NODE_LIVE
+                        && n->state.compare_exchange_strong(expected, NODE_POPPED, std::memory_order_acq_rel)) {
+                    return n;
+                }
+            }
+            return NULL;
+        }
+
+        // writer: take n away from the consumers, false if one popped it
+        bool unlink_state(Node* n) {
+            int expected = NODE_LIVE;
+            if (n->state.compare_exchange_strong(expected, NODE_UNLINKED, std::memory_order_acq_rel)) {
+                return true;
+            }
+            popped.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // unlink the claimed nodes at the head of the list, with the
+        // writer lock held
+        void unlink_popped() {
+            Node* q = header->forward[0].load(std::memory_order_relaxed);
+            size_t n = 0;
+
+            // they are first on every level they are on
+            while (q != NULL && q->state.load(std::memory_order_acquire) == NODE_POPPED) {
+                for (int k = q->forward.size() - 1; k >= 0; --k) {
+                    header->forward[k].store(q->forward[k].load(std::memory_order_relaxed), std::memory_order_release);
+                }
+                Node* next = q->forward[0].load(std::memory_order_relaxed);
+                retire(q);
+                q = next;
+                ++n;
+            }
+
+            int l = level.load(std::memory_order_relaxed);
+            while (l > 0 && header->forward[l-1].load(std::memory_order_relaxed) == NULL) {
+                --l;
+            }
+            level.store(l, std::memory_order_release);
+
+            popped.fetch_sub(n, std::memory_order_relaxed);
+            count -= n;
+        }
+
+        // unlink every claimed node, also those a spray or a later insert
+        // left behind live ones, with the writer lock held
+        void unlink_all_popped() {
+            Node* update[max_number_of_levels];
+            for (int k = 0; k < max_number_of_levels; ++k) {
+                update[k] = header;
+            }
+
+            Node* q = header->forward[0].load(std::memory_order_relaxed);
+            size_t n = 0;
+            while (q != NULL) {
+                Node* next = q->forward[0].load(std::memory_order_relaxed);
+                int h = q->forward.size();
+                if (q->state.load(std::memory_order_acquire) == NODE_POPPED) {
+                    // top level first, as in remove()
+                    for (int k = h - 1; k >= 0; --k) {
+                        update[k]->forward[k].store(q->forward[k].load(std::memory_order_relaxed), std::memory_order_release);
+                    }
+                    retire(q);
+                    ++n;
+                } else {
+                    for (int k = 0; k < h; ++k) {
+                        update[k] = q;
+                    }
+                }
+                q = next;
+            }
+
+            int l = level.load(std::memory_order_relaxed);
+            while (l > 0 && header->forward[l-1].load(std::memory_order_relaxed) == NULL) {
+                --l;
+            }
+            level.store(l, std::memory_order_release);
+
+            popped.fetch_sub(n, std::memory_order_relaxed);
+            count -= n;
+        }
+
+        // free every retired node no reader can still see; writer only,
+        // with the writer lock held
+        void free_retired() {
+#ifdef CONCURRENT_SKIPLISTS_NO_FENCES
+            const std::memory_order scan = std::memory_order_seq_cst;
+#else
+            const std::memory_order scan = std::memory_order_acquire;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+
+            uint64_t oldest = UINT64_MAX;
+            for (size_t i = 0; i < slots.size(); ++i) {
+                uint64_t e = slots[i].active.load(scan);
+                if (e != 0 && e < oldest) {
+                    oldest = e;
+                }
+            }
+
+            size_t kept = 0;
+            for (size_t i = 0; i < retired.size(); ++i) {
+                if (retired[i].first < oldest) {
+                    delete retired[i].second;
+                } else {
+                    retired[kept++] = retired[i];
+                }
+            }
+            retired.resize(kept);
+        }
+
+    public:
+        // A registered reader thread. Lookups and iteration must happen
+        // between enter() and exit(); find() does both around one lookup,
+        // batches of lookups can share one enter()/exit() pair.
+        class Reader {
+            private:
+                ConcurrentSkipLists& list;
+                ReaderSlot* slot;
+
+                // spray walk state
+                unsigned int seed;
+
+                // counted in list.consumers
+                bool consuming;
+
+                // SprayList walk: start about log p levels up and jump a
+                // random 0 .. log p nodes on each level on the way down
+                Node* spray() {
+                    int p = list.consumers.load(std::memory_order_relaxed);
+                    Node* x = list.header;
+                    if (p <= 1) {
+                        return x->forward[0].load(std::memory_order_acquire);
+                    }
+
+                    int log_p = 0;
+                    while ((1 << (log_p + 1)) <= p) {
+                        ++log_p;
+                    }
+
+                    int k = log_p + 1;
+                    int l = list.level.load(std::memory_order_acquire);
+                    if (k > l - 1) {
+                        k = l - 1;
+                    }
+
+                    for (; k >= 0; --k) {
+                        for (int j = rand_r(&seed) % (log_p + 2); j > 0; --j) {
+                            Node* next = x->forward[k].load(std::memory_order_acquire);
+                            if (next == NULL) {
+                                break;
+                            }
+                            x = next;
+                        }
+                    }
+
+                    return x == list.header ? x->forward[0].load(std::memory_order_acquire) : x;
+                }
+
+            public:
+                explicit Reader(ConcurrentSkipLists& l) : list(l), slot(NULL), consuming(false) {
+                    for (size_t i = 0; i < list.slots.size(); ++i) {
+                        bool expected = false;
+                        if (list.slots[i].used.compare_exchange_strong(expected, true)) {
+                            slot = &list.slots[i];
+                            seed = i + 1;
+                            break;
+                        }
+                    }
+                }
+
+                ~Reader() {
+                    if (consuming) {
+                        list.consumers.fetch_sub(1, std::memory_order_relaxed);
+                    }
+                    if (slot != NULL) {
+                        slot->active.store(0, std::memory_order_release);
+                        slot->used.store(false, std::memory_order_release);
+                    }
+                }
+
+                // false when all max_readers slots were taken; such a
+                // reader cannot enter the list
+                bool ok() const {
+                    return slot != NULL;
+                }
+
+                // false, and the list must not be touched, unless ok()
+                bool enter() {
+                    if (slot == NULL) {
+                        return false;
+                    }
+#ifdef CONCURRENT_SKIPLISTS_NO_FENCES
+                    slot->active.store(list.epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+#else
+                    slot->active.store(list.epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    // order the announcement before any load of the list
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+                    return true;
+                }
+
+                void exit() {
+                    if (slot != NULL) {
+                        slot->active.store(0, std::memory_order_release);
+                    }
+                }
+
+                bool find(const KeyType& key, ValType& res) {
+                    if (!enter()) {
+                        return false;
+                    }
+                    bool r = list.find(key, res);
+                    exit();
+                    return r;
+                }
+
+                // take one of the smallest elements, the smallest one when
+                // this is the only reader popping
+                bool pop_front(KeyType& key, ValType& value) {
+                    if (slot == NULL) {
+                        return false;
+                    }
+                    if (!consuming) {
+                        consuming = true;
+                        list.consumers.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    enter();
+
+                    Node* q = claim(spray());
+                    if (q == NULL) {
+                        // the spray overshot the last unclaimed node
+                        q = claim(list.header->forward[0].load(std::memory_order_acquire));
+                    }
+                    if (q != NULL) {
+                        key = q->key;
+                        value = q->value;
+                        list.popped.fetch_add(1, std::memory_order_relaxed);
+                    }
+
+                    exit();
+
+                    // help with the popped prefix unless someone else is
+                    // changing the list
+                    if (list.popped.load(std::memory_order_relaxed) >= CONCURRENT_SKIPLISTS_PURGE_BATCH
+                            && list.writer.try_lock()) {
+                        list.unlink_popped();
+                        list.writer.unlock();
+                    }
+
+                    return q != NULL;
+                }
+        };
+
+        // read-only forward iterator over level 0, valid inside enter()/exit()
+        class iterator {
+            private:
+                const Node* node;
+
+            public:
+                iterator(const Node* n = NULL) : node(n) {}
+
+                const KeyType& key() const {
+                    return node->key;
+                }
+
+                const ValType& value() const {
+                    return node->value;
+                }
+
+                iterator& operator++() {
+                    node = live(node->forward[0].load(std::memory_order_acquire));
+                    return *this;
+                }
+
+                bool operator==(const iterator& other) const {
+                    return node == other.node;
+                }
+
+                bool operator!=(const iterator& other) const {
+                    return node != other.node;
+                }
+        };
+
+        // ctor
+        ConcurrentSkipLists(int max_level_num = 16, int max_readers = CONCURRENT_SKIPLISTS_MAX_READERS) :
+            level(0), max_number_of_levels(max_level_num), levels(max_level_num),
+            count(0), epoch(1), slots(max_readers), consumers(0), popped(0) {
+                header = new Node(KeyType(), ValType(), max_number_of_levels);
+                assert(header != NULL);
+        }
+
+        // destructor, no reader may be inside the list any more
+        ~ConcurrentSkipLists() {
+            Node* p = header->forward[0].load(std::memory_order_relaxed);
+            while (p != NULL) {
+                Node* next = p->forward[0].load(std::memory_order_relaxed);
+                delete p;
+                p = next;
+            }
+
+            for (size_t i = 0; i < retired.size(); ++i) {
+                delete retired[i].second;
+            }
+
+            delete header;
+        }
+
+        // writer only, see SkipLists::seed_levels()
+        void seed_levels(uint64_t seed) {
+            levels.seed(seed);
+        }
+
+        // popped elements count until they are unlinked, see purge()
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(writer);
+            return count;
+        }
+
+        // writer only: unlink every claimed node, O(n). Pops and inserts
+        // only drop the popped prefix, so nodes popped behind a live one
+        // stay linked and counted until this runs.
+        void purge() {
+            std::lock_guard<std::mutex> lock(writer);
+            unlink_all_popped();
+        }
+
+        // writer only
+        bool insert(const KeyType& key, const ValType& value) {
+            std::lock_guard<std::mutex> lock(writer);
+            if (popped.load(std::memory_order_relaxed) >= CONCURRENT_SKIPLISTS_PURGE_BATCH) {
+                unlink_popped();
+            }
+            if (retired.size() >= CONCURRENT_SKIPLISTS_RECLAIM_BATCH) {
+                free_retired();
+            }
+
+            Node* update[max_number_of_levels];
+            Node* q = search(key, update);
+
+            if (q != NULL && q->key == key) {
+                // readers may hold q: publish a copy with the new value
+                int h = q->forward.size();
+                Node* x = new Node(key, value, h);
+                for (int k = 0; k < h; ++k) {
+                    x->forward[k].store(q->forward[k].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                }
+                for (int k = 0; k < h; ++k) {
+                    update[k]->forward[k].store(x, std::memory_order_release);
+                }
+                // if a consumer popped q first, the copy is a new entry
+                bool replaced = unlink_state(q);
+                retire(q);
+                if (!replaced) {
+                    return true;
+                }
+                // insert the same value
+                return false;
+            }
+
+            int l = level.load(std::memory_order_relaxed);
+            int k = levels.next();
+            if (k > l) {
+                k = l + 1;
+                // update index from 0
+                update[k-1] = header;
+            }
+
+            q = new Node(key, value, k);
+
+            for (int i = 0; i < k; ++i) {
+                q->forward[i].store(update[i]->forward[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            // bottom level first: q is reachable only once it is complete
+            for (int i = 0; i < k; ++i) {
+                update[i]->forward[i].store(q, std::memory_order_release);
+            }
+            if (k > l) {
+                level.store(k, std::memory_order_release);
+            }
+
+            ++count;
+
+            return true;
+        }
+
+        // writer only
+        bool remove(const KeyType& key) {
+            std::lock_guard<std::mutex> lock(writer);
+            if (retired.size() >= CONCURRENT_SKIPLISTS_RECLAIM_BATCH) {
+                free_retired();
+            }
+
+            Node* update[max_number_of_levels];
+            Node* q = search(key, update);
+
+            if (q == NULL || !(q->key == key)) {
+                return false;
+            }
+
+            // top level first, q keeps its own links for readers on it
+            for (int k = q->forward.size() - 1; k >= 0; --k) {
+                update[k]->forward[k].store(q->forward[k].load(std::memory_order_relaxed), std::memory_order_release);
+            }
+
+            int l = level.load(std::memory_order_relaxed);
+            while (l > 0 && header->forward[l-1].load(std::memory_order_relaxed) == NULL) {
+                --l;
+            }
+            level.store(l, std::memory_order_release);
+
+            // a popped node is already gone for everyone but the writer
+            bool removed = unlink_state(q);
+            retire(q);
+
+            --count;
+
+            return removed;
+        }
+
+        // writer only: free every retired node no reader can still see
+        void reclaim() {
+            std::lock_guard<std::mutex> lock(writer);
+            free_retired();
+        }
+
+        // lock-free lookup, from a reader between enter() and exit() or
+        // from the writer
+        bool find(const KeyType& key, ValType& res) const {
+            const Node* p = header;
+            const Node* q = NULL;
+
+            int k = level.load(std::memory_order_acquire);
+            while (--k >= 0) {
+                while (q = p->forward[k].load(std::memory_order_acquire), q != NULL && q->key < key) {
+                    p = q;
+                }
+            }
+
+            if (q != NULL && q->key == key && q->state.load(std::memory_order_acquire) != NODE_POPPED) {
+                res = q->value;
+                return true;
+            }
+
+            return false;
+        }
+
+        iterator begin() const {
+            return iterator(live(header->forward[0].load(std::memory_order_acquire)));
+        }
+
+        iterator end() const {
+            return iterator();
+        }
+};
+
+#endif
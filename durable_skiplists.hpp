@@ -0,0 +1,481 @@
+#ifndef _DURABLE_SKIP_LISTS_HPP
+#define _DURABLE_SKIP_LISTS_HPP
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "skiplists.hpp"
+
+// log bytes buffered before they are written out without an fsync
+#define DURABLE_SKIPLISTS_BUFFER (64 * 1024)
+
+// records replayed per insert_batch() call during recovery
+#define DURABLE_SKIPLISTS_REPLAY_BATCH 4096
+
+
+// makes the log's writes durable, fdatasync() unless a test replaces it
+typedef int (*DurableSkipListsFsync)(int fd);
+
+
+// when a write to the log reaches the disk
+enum SkipListsSync {
+    // handed to the OS within one interval by a background thread, the
+    // fsync is left to the OS; a crash of the process loses at most the
+    // last interval, a crash of the machine whatever the OS had not yet
+    // written out, and neither corrupts the log
+    SYNC_NONE,
+
+    // before insert()/remove() returns; callers that arrive while one
+    // fsync is running share the next one (group commit)
+    SYNC_COMMIT,
+
+    // fsynced within one interval, by the next write or else by the
+    // background thread; a crash loses at most that much
+    SYNC_INTERVAL
+};
+
+enum DurableSkipListsOp {
+    WAL_INSERT = 1,
+    WAL_REMOVE = 2
+};
+
+
+// SkipLists backed by a write-ahead log.
+//
+// Every insert() and remove() appends one record to the log before it
+// touches the list:
+//     [op:1][key][value, inserts only][FNV-1a of the rest:4]
+// Under SYNC_COMMIT the change reaches the list only once its record is
+// synced, so find() never sees a write a crash could still lose, and a
+// failed write leaves the list as it was. Under the other modes the
+// change is applied as soon as its record is buffered.
+// Records are raw bytes, so keys and values must be trivially copyable.
+// recover() replays the log into the list, runs of inserts through
+// SkipLists::insert_batch(), and cuts off a torn or corrupt tail left by a
+// crash. The log is never compacted.
+//
+// Under SYNC_NONE and SYNC_INTERVAL recover() starts a thread that wakes
+// once per interval and flushes whatever the writers left in the buffer.
+//
+// One mutex guards the list and the record buffer. A caller that needs its
+// records on disk becomes the leader if nobody is writing: it takes the
+// whole buffer, drops the mutex for write() and fdatasync(), then wakes
+// everyone its sync covered. Callers arriving meanwhile keep appending and
+// the next leader flushes them all in one go.
+template<typename KeyType, typename ValType>
+class DurableSkipLists {
+    static_assert(std::is_trivially_copyable<KeyType>::value && std::is_trivially_copyable<ValType>::value,
+                  "DurableSkipLists logs raw bytes");
+
+    private:
+        static constexpr size_t INSERT_RECORD = 1 + sizeof(KeyType) + sizeof(ValType) + sizeof(uint32_t);
+        static constexpr size_t REMOVE_RECORD = 1 + sizeof(KeyType) + sizeof(uint32_t);
+
+        SkipLists<KeyType, ValType> list;
+
+        std::string path;
+        int fd;
+
+        // bytes of whole records in the log, where a failed write is cut
+        // back to
+        off_t log_size;
+        DurableSkipListsFsync fsync_log;
+
+        SkipListsSync sync_mode;
+        int64_t sync_interval_ms;
+        int64_t last_sync;
+
+        std::mutex mutex;
+        std::condition_variable flushed;
+
+        // records not handed to a leader yet
+        std::vector<char> pending;
+
+        // sequence numbers of the last record appended, written, synced
+        uint64_t appended;
+        uint64_t written;
+        uint64_t synced;
+
+        // a leader is writing
+        bool flushing;
+
+        // a write failed, the log no longer matches the list
+        bool failed;
+
+        // fdatasync() calls, for tests
+        uint64_t sync_count;
+
+        // a SYNC_COMMIT write waiting for its record to be synced, on the
+        // stack of its caller
+        struct Change {
+            uint64_t seq;
+            char op;
+            KeyType key;
+            ValType value;
+
+            // what the list returned, once applied
+            bool result;
+        };
+
+        // logged but not yet applied changes, in seq order
+        std::vector<Change*> waiting;
+
+        // flushes the buffer once per interval, see SkipListsSync
+        std::thread flusher;
+        std::condition_variable wakeup;
+        bool stopping;
+
+        static uint32_t checksum(const char* p, size_t n) {
+            uint32_t h = 2166136261u;
+            for (size_t i = 0; i < n; ++i) {
+                h = (h ^ (unsigned char)p[i]) * 16777619u;
+            }
+            return h;
+        }
+
+        uint64_t append(char op, const KeyType& key, const ValType* value) {
+            size_t start = pending.size();
+            pending.resize(start + (value ? INSERT_RECORD : REMOVE_RECORD));
+
+            char* p = &pending[start];
+            *p++ = op;
+            memcpy(p, &key, sizeof(KeyType));
+            p += sizeof(KeyType);
+            if (value) {
+                memcpy(p, value, sizeof(ValType));
+                p += sizeof(ValType);
+            }
+            uint32_t sum = checksum(&pending[start], p - &pending[start]);
+            memcpy(p, &sum, sizeof(sum));
+
+            return ++appended;
+        }
+
+        bool write_all(const std::vector<char>& buf) {
+            size_t done = 0;
+            while (done < buf.size()) {
+                ssize_t n = ::write(fd, &buf[done], buf.size() - done);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                done += n;
+            }
+            return true;
+        }
+
+        // fsync the directory of the log, so that a log just created
+        // survives a crash
+        bool sync_dir() {
+            size_t slash = path.rfind('/');
+            std::string dir = slash == std::string::npos ? "." : path.substr(0, slash ? slash : 1);
+            int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+            if (dfd < 0) {
+                return false;
+            }
+            bool r = fsync(dfd) == 0;
+            close(dfd);
+            return r;
+        }
+
+        // apply the waiting changes whose records are synced up to seq
+        void apply(uint64_t seq) {
+            size_t i = 0;
+            for (; i < waiting.size() && waiting[i]->seq <= seq; ++i) {
+                Change* c = waiting[i];
+                c->result = c->op == WAL_INSERT ? list.insert(c->key, c->value) : list.remove(c->key);
+            }
+            waiting.erase(waiting.begin(), waiting.begin() + i);
+        }
+
+        // make records up to seq written, and synced if sync is set; the
+        // mutex is held on entry and on return
+        bool flush(std::unique_lock<std::mutex>& lock, uint64_t seq, bool sync) {
+            while (!failed && (sync ? synced : written) < seq) {
+                if (flushing) {
+                    flushed.wait(lock);
+                    continue;
+                }
+
+                // become the leader for everything appended so far
+                flushing = true;
+                std::vector<char> batch;
+                batch.swap(pending);
+                uint64_t upto = appended;
+                off_t start = log_size;
+                lock.unlock();
+
+                bool ok = write_all(batch);
+                if (ok && sync) {
+                    ok = fsync_log(fd) == 0;
+                }
+                if (!ok) {
+                    // a partial write, or a whole one the disk may not
+                    // hold, must not come back on recover()
+                    if (ftruncate(fd, start) == 0) {
+                        fsync_log(fd);
+                    }
+                    lseek(fd, start, SEEK_SET);
+                }
+
+                lock.lock();
+                flushing = false;
+                if (ok) {
+                    log_size = start + batch.size();
+                    written = upto;
+                    if (sync) {
+                        synced = upto;
+                        last_sync = skiplists_monotonic_ms();
+                        ++sync_count;
+                        apply(upto);
+                    }
+                } else {
+                    // the changes never reach the list
+                    failed = true;
+                    waiting.clear();
+                }
+                flushed.notify_all();
+            }
+
+            return !failed;
+        }
+
+        // apply the SYNC_NONE or SYNC_INTERVAL policy to a record just
+        // appended, never waiting for a running leader
+        bool commit(std::unique_lock<std::mutex>& lock, uint64_t seq) {
+            if (flushing) {
+                return !failed;
+            }
+
+            if (sync_mode == SYNC_INTERVAL && skiplists_monotonic_ms() - last_sync >= sync_interval_ms) {
+                return flush(lock, seq, true);
+            }
+            if (pending.size() >= DURABLE_SKIPLISTS_BUFFER) {
+                return flush(lock, seq, false);
+            }
+            return !failed;
+        }
+
+        void flush_loop() {
+            std::unique_lock<std::mutex> lock(mutex);
+            bool sync = sync_mode == SYNC_INTERVAL;
+            while (!stopping) {
+                wakeup.wait_for(lock, std::chrono::milliseconds(sync_interval_ms > 0 ? sync_interval_ms : 1));
+                if (!stopping && !flushing && (sync ? synced : written) < appended) {
+                    flush(lock, appended, sync);
+                }
+            }
+        }
+
+    public:
+        DurableSkipLists(const std::string& log_path, SkipListsSync sync_policy = SYNC_COMMIT,
+                         int64_t interval_ms = 100, int max_level_num = 16,
+                         SkipListsBalance balance_mode = RANDOMIZED_LEVELS) :
+            list(max_level_num, balance_mode), path(log_path), fd(-1), log_size(0), fsync_log(fdatasync),
+            sync_mode(sync_policy), sync_interval_ms(interval_ms), last_sync(0),
+            appended(0), written(0), synced(0), flushing(false), failed(false), sync_count(0),
+            stopping(false) {
+        }
+
+        ~DurableSkipLists() {
+            if (flusher.joinable()) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wakeup.notify_one();
+                flusher.join();
+            }
+            if (fd >= 0) {
+                sync();
+                close(fd);
+            }
+        }
+
+        // Open the log, creating it if missing, and replay it into the
+        // list. Must be called once, before any write.
+        bool recover() {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (fd >= 0) {
+                return false;
+            }
+
+            int rfd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (rfd < 0) {
+                return false;
+            }
+            if (!sync_dir()) {
+                close(rfd);
+                return false;
+            }
+
+            std::vector<char> log;
+            char buf[64 * 1024];
+            ssize_t n;
+            while ((n = read(rfd, buf, sizeof(buf))) != 0) {
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    close(rfd);
+                    return false;
+                }
+                log.insert(log.end(), buf, buf + n);
+            }
+
+            std::vector<std::pair<KeyType, ValType> > batch;
+            size_t off = 0;
+            while (off < log.size()) {
+                char op = log[off];
+                size_t len = op == WAL_INSERT ? INSERT_RECORD : REMOVE_RECORD;
+                if ((op != WAL_INSERT && op != WAL_REMOVE) || off + len > log.size()) {
+                    break;
+                }
+
+                uint32_t sum;
+                memcpy(&sum, &log[off + len - sizeof(sum)], sizeof(sum));
+                if (sum != checksum(&log[off], len - sizeof(sum))) {
+                    break;
+                }
+
+                std::pair<KeyType, ValType> item;
+                memcpy(&item.first, &log[off + 1], sizeof(KeyType));
+                if (op == WAL_INSERT) {
+                    memcpy(&item.second, &log[off + 1 + sizeof(KeyType)], sizeof(ValType));
+                    batch.push_back(item);
+                }
+
+                if (op == WAL_REMOVE || batch.size() == DURABLE_SKIPLISTS_REPLAY_BATCH) {
+                    list.insert_batch(batch);
+                    batch.clear();
+                }
+                if (op == WAL_REMOVE) {
+                    list.remove(item.first);
+                }
+
+                off += len;
+            }
+            list.insert_batch(batch);
+
+            // drop the torn tail so new records follow the last good one
+            if (off < log.size() && (ftruncate(rfd, off) != 0 || fdatasync(rfd) != 0)) {
+                close(rfd);
+                return false;
+            }
+            if (lseek(rfd, 0, SEEK_END) < 0) {
+                close(rfd);
+                return false;
+            }
+
+            fd = rfd;
+            log_size = (off_t)off;
+            last_sync = skiplists_monotonic_ms();
+            if (sync_mode != SYNC_COMMIT) {
+                flusher = std::thread(&DurableSkipLists::flush_loop, this);
+            }
+            return true;
+        }
+
+        // same as SkipLists::insert(); once the log cannot be written the
+        // list takes no more writes, see ok()
+        bool insert(const KeyType& key, const ValType& value) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (fd < 0 || failed) {
+                return false;
+            }
+
+            uint64_t seq = append(WAL_INSERT, key, &value);
+            if (sync_mode == SYNC_COMMIT) {
+                Change c = { seq, WAL_INSERT, key, value, false };
+                waiting.push_back(&c);
+                return flush(lock, seq, true) && c.result;
+            }
+
+            bool r = list.insert(key, value);
+            return commit(lock, seq) && r;
+        }
+
+        bool remove(const KeyType& key) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (fd < 0 || failed) {
+                return false;
+            }
+
+            // nothing to log when the key is missing and no logged
+            // change could add it
+            ValType v;
+            if (waiting.empty() && !list.find(key, v)) {
+                return false;
+            }
+
+            uint64_t seq = append(WAL_REMOVE, key, NULL);
+            if (sync_mode == SYNC_COMMIT) {
+                Change c = { seq, WAL_REMOVE, key, ValType(), false };
+                waiting.push_back(&c);
+                return flush(lock, seq, true) && c.result;
+            }
+
+            list.remove(key);
+            return commit(lock, seq);
+        }
+
+        bool find(const KeyType& key, ValType& res) {
+            std::unique_lock<std::mutex> lock(mutex);
+            return list.find(key, res);
+        }
+
+        size_t size() {
+            std::unique_lock<std::mutex> lock(mutex);
+            return list.size();
+        }
+
+        // write and fsync everything logged so far
+        bool sync() {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (fd < 0) {
+                return false;
+            }
+            return flush(lock, appended, true);
+        }
+
+        // false once a write to the log failed
+        bool ok() {
+            std::unique_lock<std::mutex> lock(mutex);
+            return !failed;
+        }
+
+        uint64_t syncs() {
+            std::unique_lock<std::mutex> lock(mutex);
+            return sync_count;
+        }
+
+        // records appended to the log so far, for tests
+        uint64_t logged() {
+            std::unique_lock<std::mutex> lock(mutex);
+            return appended;
+        }
+
+        // use another call to make log writes durable
+        void set_fsync(DurableSkipListsFsync f) {
+            std::unique_lock<std::mutex> lock(mutex);
+            fsync_log = f;
+        }
+};
+
+#endif
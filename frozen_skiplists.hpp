@@ -0,0 +1,253 @@
+#ifndef _FROZEN_SKIP_LISTS_HPP
+#define _FROZEN_SKIP_LISTS_HPP
+
+#include <vector>
+#include <new>
+#include <assert.h>
+#include <stddef.h>
+
+#include "skiplists.hpp"
+
+#define CACHELINE 64
+
+
+// std allocator handing out cache-line aligned blocks
+template<typename T>
+struct CacheAlignedAllocator {
+    typedef T value_type;
+
+    CacheAlignedAllocator() {}
+
+    template<typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(CACHELINE)));
+    }
+
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(CACHELINE));
+    }
+
+    template<typename U>
+    bool operator==(const CacheAlignedAllocator<U>&) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const CacheAlignedAllocator<U>&) const {
+        return false;
+    }
+};
+
+
+// Immutable, read-optimized copy of a SkipLists.
+//
+// Keys and values are kept in two separate sorted arrays. Above them sit
+// implicit index levels sampled from the keys, not taken from the towers
+// of the live list: level j holds every FANOUT^j-th key, all levels packed
+// top first into one buffer, each padded to whole blocks of FANOUT keys. A block is one cache line for
+// small keys, so a lookup reads one line per level and decides where to
+// go next by counting keys below the target instead of branching on
+// each compare.
+template<typename KeyType, typename ValType>
+class FrozenSkipLists {
+    public:
+        // keys per index block
+        static constexpr size_t FANOUT =
+            sizeof(KeyType) * 4 > CACHELINE ? 4 : CACHELINE / sizeof(KeyType);
+
+    private:
+        typedef std::vector<KeyType, CacheAlignedAllocator<KeyType> > key_array;
+        typedef std::vector<ValType, CacheAlignedAllocator<ValType> > value_array;
+
+        // number of elements
+        size_t count;
+
+        // sorted keys, padded with the largest key to whole blocks
+        key_array keys;
+        value_array values;
+
+        // index levels 1 .. levels-1, top level first
+        key_array index;
+
+        // per level: number of real keys and offset into index
+        std::vector<size_t> level_size;
+        std::vector<size_t> level_offset;
+
+        static size_t padded(size_t n) {
+            return (n + FANOUT - 1) / FANOUT * FANOUT;
+        }
+
+        const KeyType* level_data(size_t j) const {
+            return j == 0 ? keys.data() : index.data() + level_offset[j];
+        }
+
+        // keys below key in one block, no data-dependent branches
+        static size_t count_less(const KeyType* block, const KeyType& key) {
+            size_t c = 0;
+            for (size_t i = 0; i < FANOUT; ++i) {
+                c += (block[i] < key);
+            }
+            return c;
+        }
+
+        // number of keys less than key
+        size_t rank(const KeyType& key) const {
+            if (count == 0) {
+                return 0;
+            }
+
+            size_t j = level_size.size() - 1;
+            size_t c = count_less(level_data(j), key);
+            if (c > level_size[j]) {
+                c = level_size[j];
+            }
+
+            while (j > 0) {
+                if (c == 0) {
+                    return 0;
+                }
+                // the key lies under the last entry below it
+                size_t start = (c - 1) * FANOUT;
+                --j;
+                if (j == 0) {
+                    __builtin_prefetch(&values[start]);
+                }
+                c = start + count_less(level_data(j) + start, key);
+                if (c > level_size[j]) {
+                    c = level_size[j];
+                }
+            }
+
+            return c;
+        }
+
+    public:
+        // read-only iterator in key order
+        class iterator {
+            private:
+                const FrozenSkipLists* list;
+                size_t pos;
+
+            public:
+                iterator(const FrozenSkipLists* l = NULL, size_t i = 0) : list(l), pos(i) {}
+
+                const KeyType& key() const {
+                    return list->keys[pos];
+                }
+
+                const ValType& value() const {
+                    return list->values[pos];
+                }
+
+                iterator& operator++() {
+                    ++pos;
+                    return *this;
+                }
+
+                bool operator==(const iterator& other) const {
+                    return pos == other.pos;
+                }
+
+                bool operator!=(const iterator& other) const {
+                    return pos != other.pos;
+                }
+        };
+
+        // O(n): one walk of level 0 to collect the unexpired nodes, then
+        // every copy and every index level is independent and runs in
+        // parallel when built with OpenMP
+        template<bool Expiring>
+        explicit FrozenSkipLists(const SkipLists<KeyType, ValType, Expiring>& list) {
+            std::vector<typename SkipLists<KeyType, ValType, Expiring>::iterator> nodes;
+            nodes.reserve(list.size());
+            for (typename SkipLists<KeyType, ValType, Expiring>::iterator it = list.begin(); it != list.end(); ++it) {
+                nodes.push_back(it);
+            }
+            count = nodes.size();
+
+            keys.resize(padded(count));
+            values.resize(count);
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+            for (long i = 0; i < (long)count; ++i) {
+                keys[i] = nodes[i].key();
+                values[i] = nodes[i].value();
+            }
+            for (size_t i = count; i < keys.size(); ++i) {
+                keys[i] = keys[count - 1];
+            }
+
+            // level sizes down to a top level of a single block
+            level_size.push_back(count);
+            while (level_size.back() > FANOUT) {
+                level_size.push_back((level_size.back() + FANOUT - 1) / FANOUT);
+            }
+
+            // lay the index levels out top first
+            level_offset.assign(level_size.size(), 0);
+            size_t total = 0;
+            for (size_t j = level_size.size() - 1; j >= 1; --j) {
+                level_offset[j] = total;
+                total += padded(level_size[j]);
+            }
+            index.resize(total);
+
+            size_t stride = 1;
+            for (size_t j = 1; j < level_size.size(); ++j) {
+                stride *= FANOUT;
+                KeyType* data = index.data() + level_offset[j];
+                size_t n = level_size[j];
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                for (long i = 0; i < (long)n; ++i) {
+                    data[i] = keys[i * stride];
+                }
+                for (size_t i = n; i < padded(n); ++i) {
+                    data[i] = keys[count - 1];
+                }
+            }
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        iterator begin() const {
+            return iterator(this, 0);
+        }
+
+        iterator end() const {
+            return iterator(this, count);
+        }
+
+        // first element whose key is not less than key
+        iterator lower_bound(const KeyType& key) const {
+            return iterator(this, rank(key));
+        }
+
+        bool find(const KeyType& key, ValType& res) const {
+            size_t c = rank(key);
+
+            if (c < count && keys[c] == key) {
+                res = values[c];
+                return true;
+            }
+
+            return false;
+        }
+};
+
+
+// convert a live list into its read-optimized form
+template<typename KeyType, typename ValType, bool Expiring>
+FrozenSkipLists<KeyType, ValType> freeze(const SkipLists<KeyType, ValType, Expiring>& list) {
+    return FrozenSkipLists<KeyType, ValType>(list);
+}
+
+#endif
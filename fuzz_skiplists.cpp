@@ -0,0 +1,543 @@
+// Differential fuzzing of every list in this repository against std::map.
+//
+// An input is an operation stream: each operation is one opcode byte and
+// its operands (missing bytes read as 0), applied to every list and to a
+// std::map model, with results and structural invariants compared as it
+// goes. Built with -DSKIPLISTS_LIBFUZZER it is a libFuzzer target,
+// otherwise main() runs seeded random streams plus a threaded run of
+// ConcurrentSkipLists, for use under ASan, UBSan and TSan (make asan,
+// make ubsan, make tsan).
+
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "skiplists.hpp"
+#include "compact_skiplists.hpp"
+#include "frozen_skiplists.hpp"
+#include "concurrent_skiplists.hpp"
+#include "augmented_skiplists.hpp"
+#include "numa_skiplists.hpp"
+
+using namespace std;
+
+
+// unlike assert(), also checked in NDEBUG and fuzzer builds
+#define CHECK(c) \
+    do { \
+        if (!(c)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); \
+            abort(); \
+        } \
+    } while (0)
+
+
+struct Input {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+
+    Input(const uint8_t* d, size_t n) : data(d), size(n), pos(0) {}
+
+    bool done() const {
+        return pos >= size;
+    }
+
+    uint8_t byte() {
+        return pos < size ? data[pos++] : 0;
+    }
+
+    // a small key space, so that operations collide
+    int key() {
+        return byte();
+    }
+
+    int value() {
+        int hi = byte();
+        return (int16_t)(hi << 8 | byte());
+    }
+};
+
+
+static int64_t fuzz_now = 1000;
+
+static int64_t fuzz_clock()
+{
+    return fuzz_now;
+}
+
+
+// the plain lists, one model; tower heights come from seed
+static void run_plain(Input& in, uint64_t seed)
+{
+    std::map<int, int> model;
+
+    SkipLists<int, int> rnd(16, RANDOMIZED_LEVELS);
+    SkipLists<int, int> det(16, DETERMINISTIC_LEVELS);
+    CompactSkipLists<int, int> compact;
+    AugmentedSkipLists<int, int> sums;
+    AugmentedSkipLists<int, int, MaxMonoid<int> > maxs;
+    NumaSkipLists<int, int> numa(16, 2);
+    ConcurrentSkipLists<int, int> conc;
+    rnd.seed_levels(seed);
+    compact.seed_levels(seed + 1);
+    sums.seed_levels(seed + 2);
+    maxs.seed_levels(seed + 3);
+    numa.seed_levels(seed + 4);
+    conc.seed_levels(seed + 5);
+
+    bool r;
+    int v;
+
+    while (!in.done()) {
+        switch (in.byte() % 8) {
+            case 0: {
+                int key = in.key();
+                int value = in.value();
+                bool added = model.count(key) == 0;
+                model[key] = value;
+
+                CHECK(rnd.insert(key, value) == added);
+                CHECK(det.insert(key, value) == added);
+                CHECK(compact.insert(key, value) == added);
+                CHECK(sums.insert(key, value) == added);
+                CHECK(maxs.insert(key, value) == added);
+                CHECK(numa.insert(key, value) == added);
+                CHECK(conc.insert(key, value) == added);
+                break;
+            }
+
+            case 1: {
+                int key = in.key();
+                bool removed = model.erase(key) == 1;
+
+                CHECK(rnd.remove(key) == removed);
+                CHECK(det.remove(key) == removed);
+                CHECK(compact.remove(key) == removed);
+                CHECK(sums.remove(key) == removed);
+                CHECK(maxs.remove(key) == removed);
+                CHECK(numa.remove(key) == removed);
+                CHECK(conc.remove(key) == removed);
+                break;
+            }
+
+            case 2: {
+                // 256 is past every key
+                int key = in.key() + (in.byte() & 1 ? 256 : 0);
+                std::map<int, int>::iterator it = model.find(key);
+                bool found = it != model.end();
+                int expected = found ? it->second : 0;
+
+                v = 0;
+                r = rnd.find(key, v);
+                CHECK(r == found && (!r || v == expected));
+                r = det.find(key, v);
+                CHECK(r == found && (!r || v == expected));
+                r = compact.find(key, v);
+                CHECK(r == found && (!r || v == expected));
+                r = sums.find(key, v);
+                CHECK(r == found && (!r || v == expected));
+                for (int replica = 0; replica < numa.replica_count(); ++replica) {
+                    r = numa.find(key, v, replica);
+                    CHECK(r == found && (!r || v == expected));
+                }
+                r = conc.find(key, v);
+                CHECK(r == found && (!r || v == expected));
+                break;
+            }
+
+            case 3: {
+                // pop from the two lists that can, remove elsewhere
+                int key = -1;
+                r = rnd.pop_front(key, v);
+                CHECK(r == !model.empty());
+                if (!r) {
+                    r = det.pop_front(key, v);
+                    CHECK(!r);
+                    break;
+                }
+                CHECK(key == model.begin()->first && v == model.begin()->second);
+                int key2 = -1;
+                r = det.pop_front(key2, v);
+                CHECK(r && key2 == key);
+                model.erase(model.begin());
+
+                CHECK(compact.remove(key));
+                CHECK(sums.remove(key));
+                CHECK(maxs.remove(key));
+                CHECK(numa.remove(key));
+                CHECK(conc.remove(key));
+                break;
+            }
+
+            case 4: {
+                int lo = in.key();
+                int hi = in.key();
+                int sum = SumMonoid<int>::identity();
+                int max = MaxMonoid<int>::identity();
+                for (std::map<int, int>::iterator it = model.lower_bound(lo); it != model.end() && it->first <= hi; ++it) {
+                    sum += it->second;
+                    max = std::max(max, it->second);
+                }
+                CHECK(sums.aggregate(lo, hi) == sum);
+                CHECK(maxs.aggregate(lo, hi) == max);
+                break;
+            }
+
+            case 5: {
+                // a run of inserts, ascending unless the step wraps around
+                std::vector<std::pair<int, int> > items;
+                int n = in.byte() % 16;
+                int key = in.key();
+                int step = in.byte() % 8;
+                for (int i = 0; i < n; ++i) {
+                    items.push_back(std::make_pair(key, in.value()));
+                    key = (key + step) % 256;
+                }
+
+                size_t added = 0;
+                for (size_t i = 0; i < items.size(); ++i) {
+                    added += model.count(items[i].first) == 0;
+                    model[items[i].first] = items[i].second;
+
+                    compact.insert(items[i].first, items[i].second);
+                    sums.insert(items[i].first, items[i].second);
+                    maxs.insert(items[i].first, items[i].second);
+                    numa.insert(items[i].first, items[i].second);
+                    conc.insert(items[i].first, items[i].second);
+                }
+                CHECK(rnd.insert_batch(items) == added);
+                CHECK(det.insert_batch(items) == added);
+                break;
+            }
+
+            case 6: {
+                CHECK(rnd.check_invariants());
+                CHECK(det.check_invariants());
+                CHECK(compact.check_invariants());
+                CHECK(sums.check_invariants());
+                CHECK(maxs.check_invariants());
+                CHECK(numa.check_invariants());
+                break;
+            }
+
+            case 7: {
+                // freeze a snapshot and probe it
+                FrozenSkipLists<int, int> frozen = freeze(in.byte() & 1 ? rnd : det);
+                CHECK(frozen.size() == model.size());
+                int key = in.key();
+                std::map<int, int>::iterator it = model.lower_bound(key);
+                FrozenSkipLists<int, int>::iterator f = frozen.lower_bound(key);
+                CHECK((it == model.end()) == (f == frozen.end()));
+                CHECK(it == model.end() || (f.key() == it->first && f.value() == it->second));
+                r = frozen.find(key, v);
+                CHECK(r == (model.count(key) == 1) && (!r || v == model[key]));
+                break;
+            }
+        }
+    }
+
+    CHECK(rnd.check_invariants());
+    CHECK(det.check_invariants());
+    CHECK(compact.check_invariants());
+    CHECK(sums.check_invariants());
+    CHECK(maxs.check_invariants());
+    CHECK(numa.check_invariants());
+
+    CHECK(rnd.size() == model.size());
+    CHECK(det.size() == model.size());
+    CHECK(compact.size() == model.size());
+    CHECK(sums.size() == model.size());
+    CHECK(numa.size() == model.size());
+    conc.reclaim();
+    CHECK(conc.size() == model.size());
+
+    // whole contents, in order
+    std::map<int, int>::iterator it = model.begin();
+    SkipLists<int, int>::iterator a = rnd.begin();
+    SkipLists<int, int>::iterator b = det.begin();
+    ConcurrentSkipLists<int, int>::iterator c = conc.begin();
+    for (; it != model.end(); ++it, ++a, ++b, ++c) {
+        CHECK(a != rnd.end() && a.key() == it->first && a.value() == it->second);
+        CHECK(b != det.end() && b.key() == it->first && b.value() == it->second);
+        CHECK(c != conc.end() && c.key() == it->first && c.value() == it->second);
+    }
+    CHECK(a == rnd.end() && b == det.end() && c == conc.end());
+}
+
+
+// entries with TTLs against a model that knows when each one expires
+static void run_ttl(Input& in, uint64_t seed)
+{
+    // key -> (value, expire_at or 0)
+    std::map<int, std::pair<int, int64_t> > model;
+    fuzz_now = 1000;
+
+    SkipLists<int, int, true> list(16, in.byte() & 1 ? DETERMINISTIC_LEVELS : RANDOMIZED_LEVELS);
+    list.seed_levels(seed);
+    list.set_clock(fuzz_clock);
+
+    bool r;
+    int v;
+    int key;
+
+    while (!in.done()) {
+        switch (in.byte() % 8) {
+            case 0:
+            case 1: {
+                key = in.key();
+                int value = in.value();
+                int64_t ttl = in.byte() % 8;
+                int64_t expire_at = ttl ? fuzz_now + ttl : 0;
+
+                std::map<int, std::pair<int, int64_t> >::iterator it = model.find(key);
+                bool added = it == model.end() || (it->second.second != 0 && it->second.second <= fuzz_now);
+                model[key] = std::make_pair(value, expire_at);
+
+                r = ttl ? list.insert(key, value, ttl) : list.insert(key, value);
+                CHECK(r == added);
+                break;
+            }
+
+            case 2: {
+                key = in.key();
+                CHECK(list.remove(key) == (model.erase(key) == 1));
+                break;
+            }
+
+            case 3: {
+                // an expired entry is a miss and goes away
+                key = in.key();
+                std::map<int, std::pair<int, int64_t> >::iterator it = model.find(key);
+                bool found = it != model.end();
+                if (found && it->second.second != 0 && it->second.second <= fuzz_now) {
+                    model.erase(it);
+                    found = false;
+                }
+
+                r = list.find(key, v);
+                CHECK(r == found && (!r || v == model[key].first));
+                break;
+            }
+
+            case 4: {
+                // front() skips expired entries, pop_front_batch() drops
+                // the ones it passes
+                std::map<int, std::pair<int, int64_t> >::iterator it = model.begin();
+                while (it != model.end() && it->second.second != 0 && it->second.second <= fuzz_now) {
+                    ++it;
+                }
+                r = list.front(key, v);
+                CHECK(r == (it != model.end()) && (!r || (key == it->first && v == it->second.first)));
+
+                size_t n = in.byte() % 4;
+                std::vector<std::pair<int, int> > out;
+                size_t popped = list.pop_front_batch(n, out);
+                CHECK(popped == out.size());
+                size_t expected = 0;
+                while (expected < n && !model.empty()) {
+                    it = model.begin();
+                    bool live = it->second.second == 0 || it->second.second > fuzz_now;
+                    if (live) {
+                        CHECK(expected < out.size() && out[expected].first == it->first
+                              && out[expected].second == it->second.first);
+                        ++expected;
+                    }
+                    model.erase(it);
+                }
+                CHECK(popped == expected);
+                break;
+            }
+
+            case 5: {
+                fuzz_now += in.byte() % 4;
+                break;
+            }
+
+            case 6: {
+                size_t budget = in.byte() % 4;
+                if (budget == 3) {
+                    budget = (size_t)-1;
+                }
+
+                std::vector<int> expired;
+                for (std::map<int, std::pair<int, int64_t> >::iterator it = model.begin(); it != model.end(); ++it) {
+                    if (it->second.second != 0 && it->second.second <= fuzz_now) {
+                        expired.push_back(it->first);
+                    }
+                }
+
+                size_t n = list.evict_expired(budget);
+                CHECK(n == std::min(budget, expired.size()));
+
+                // which ones went depends on node addresses; finish the rest
+                size_t left = 0;
+                for (size_t i = 0; i < expired.size(); ++i) {
+                    left += list.remove(expired[i]);
+                    model.erase(expired[i]);
+                }
+                CHECK(left == expired.size() - n);
+                break;
+            }
+
+            case 7: {
+                CHECK(list.check_invariants());
+                CHECK(list.size() == model.size());
+
+                // iteration, lower_bound() and freeze() see the live entries
+                std::vector<std::pair<int, int> > live;
+                for (std::map<int, std::pair<int, int64_t> >::iterator it = model.begin(); it != model.end(); ++it) {
+                    if (it->second.second == 0 || it->second.second > fuzz_now) {
+                        live.push_back(std::make_pair(it->first, it->second.first));
+                    }
+                }
+
+                size_t i = 0;
+                for (SkipLists<int, int, true>::iterator it = list.begin(); it != list.end(); ++it, ++i) {
+                    CHECK(i < live.size() && it.key() == live[i].first && it.value() == live[i].second);
+                }
+                CHECK(i == live.size());
+
+                key = in.key();
+                i = std::lower_bound(live.begin(), live.end(), std::make_pair(key, INT_MIN)) - live.begin();
+                SkipLists<int, int, true>::iterator lb = list.lower_bound(key);
+                CHECK(i == live.size() ? lb == list.end() : (lb != list.end() && lb.key() == live[i].first));
+
+                FrozenSkipLists<int, int> frozen(list);
+                CHECK(frozen.size() == live.size());
+                for (i = 0; i < live.size(); ++i) {
+                    CHECK(frozen.find(live[i].first, v) && v == live[i].second);
+                }
+                break;
+            }
+        }
+    }
+
+    CHECK(list.check_invariants());
+    CHECK(list.size() == model.size());
+}
+
+
+// every list is seeded from the input, so that an input always builds
+// the same shapes and a failure replays
+static void run(const uint8_t* data, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    uint64_t seed = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+        seed = (seed ^ data[i]) * 1099511628211ULL;
+    }
+
+    Input in(data + 1, size - 1);
+    if (data[0] & 1) {
+        run_ttl(in, seed);
+    } else {
+        run_plain(in, seed);
+    }
+}
+
+
+#ifdef SKIPLISTS_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    run(data, size);
+    return 0;
+}
+
+#else
+
+static std::atomic<bool> writing(true);
+
+// values always encode their key, whatever the writer does
+static void concurrent_reader(ConcurrentSkipLists<int, int>* list, unsigned int seed)
+{
+    ConcurrentSkipLists<int, int>::Reader reader(*list);
+
+    while (writing.load()) {
+        int key = rand_r(&seed) % 256;
+        int v = -1;
+        if (reader.find(key, v)) {
+            CHECK(v % 256 == key);
+        }
+
+        reader.enter();
+        int last = -1;
+        for (ConcurrentSkipLists<int, int>::iterator it = list->begin(); it != list->end(); ++it) {
+            CHECK(it.key() > last && it.value() % 256 == it.key());
+            last = it.key();
+        }
+        reader.exit();
+    }
+}
+
+// one writer and a few readers on ConcurrentSkipLists, for TSan
+static void run_concurrent(unsigned int seed)
+{
+    ConcurrentSkipLists<int, int> list;
+    list.seed_levels(seed);
+    std::map<int, int> model;
+
+    writing.store(true);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; ++i) {
+        readers.push_back(std::thread(concurrent_reader, &list, seed + i));
+    }
+
+    for (int i = 0; i < 100000; ++i) {
+        int key = rand_r(&seed) % 256;
+        if (rand_r(&seed) % 3) {
+            int value = key + 256 * (rand_r(&seed) % 1000);
+            CHECK(list.insert(key, value) == (model.count(key) == 0));
+            model[key] = value;
+        } else {
+            CHECK(list.remove(key) == (model.erase(key) == 1));
+        }
+    }
+
+    writing.store(false);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        readers[i].join();
+    }
+
+    list.reclaim();
+    CHECK(list.size() == model.size());
+    for (std::map<int, int>::iterator it = model.begin(); it != model.end(); ++it) {
+        int v = -1;
+        CHECK(list.find(it->first, v) && v == it->second);
+    }
+}
+
+// fuzz_skiplists [iterations [seed]]
+int main(int argc, char* argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    unsigned int seed = argc > 2 ? atoi(argv[2]) : 1;
+
+    cout << "differential, " << iterations << " streams, seed " << seed << endl;
+    std::vector<uint8_t> data;
+    for (int i = 0; i < iterations; ++i) {
+        data.resize(rand_r(&seed) % 4096);
+        for (size_t j = 0; j < data.size(); ++j) {
+            data[j] = rand_r(&seed);
+        }
+        run(data.data(), data.size());
+    }
+
+    cout << "concurrent" << endl;
+    run_concurrent(seed);
+
+    return 0;
+}
+
+#endif
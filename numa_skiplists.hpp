@@ -0,0 +1,514 @@
+#ifndef _NUMA_SKIP_LISTS_HPP
+#define _NUMA_SKIP_LISTS_HPP
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <type_traits>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "skiplists.hpp"
+
+// memory policies of mbind(2), spelled out so that libnuma is not needed
+#define NUMA_SKIPLISTS_MPOL_PREFERRED 1
+#define NUMA_SKIPLISTS_MPOL_INTERLEAVE 3
+
+// bytes mapped at a time for nodes
+#define NUMA_SKIPLISTS_CHUNK (1 << 20)
+
+// lookups between two getcpu() calls of a thread
+#define NUMA_SKIPLISTS_RECHECK 4096
+
+
+// ids of the nodeN entries in dir, sorted; node ids need not be dense,
+// offline or hot-removed nodes leave holes. Just node 0 when there are none.
+inline std::vector<int> numa_skiplists_read_nodes(const char* path) {
+    std::vector<int> ids;
+    DIR* dir = opendir(path);
+    if (dir != NULL) {
+        struct dirent* e;
+        while ((e = readdir(dir)) != NULL) {
+            int id;
+            char c;
+            if (sscanf(e->d_name, "node%d%c", &id, &c) == 1 && id >= 0) {
+                ids.push_back(id);
+            }
+        }
+        closedir(dir);
+    }
+    if (ids.empty()) {
+        ids.push_back(0);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// ids of the NUMA nodes in /sys/devices/system/node
+inline const std::vector<int>& numa_skiplists_node_ids() {
+    static const std::vector<int> ids = numa_skiplists_read_nodes("/sys/devices/system/node");
+    return ids;
+}
+
+inline int numa_skiplists_nodes() {
+    return (int)numa_skiplists_node_ids().size();
+}
+
+// the node of the CPU the calling thread runs on, rechecked now and then
+// since threads migrate
+inline int numa_skiplists_current_node() {
+    static thread_local unsigned int node = 0;
+    static thread_local int calls = 0;
+    if (calls-- == 0) {
+        unsigned int cpu;
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+            node = 0;
+        }
+        calls = NUMA_SKIPLISTS_RECHECK;
+    }
+    return (int)node;
+}
+
+// Place [addr, addr + len) on node, or interleave it over all nodes for
+// node < 0. Must run before the pages are first touched. Failing is fine:
+// the pages then go wherever first touch puts them.
+inline void numa_skiplists_bind(void* addr, size_t len, int node) {
+    const std::vector<int>& ids = numa_skiplists_node_ids();
+    if (ids.size() <= 1 || ids.back() >= 64 || node >= 64) {
+        return;
+    }
+
+    unsigned long mask = 0;
+    if (node < 0) {
+        for (size_t i = 0; i < ids.size(); ++i) {
+            mask |= 1UL << ids[i];
+        }
+    } else {
+        mask = 1UL << node;
+    }
+    int mode = node < 0 ? NUMA_SKIPLISTS_MPOL_INTERLEAVE : NUMA_SKIPLISTS_MPOL_PREFERRED;
+    syscall(SYS_mbind, addr, len, mode, &mask, sizeof(mask) * 8 + 1, 0);
+}
+
+
+// bump allocator over mmap()ed chunks placed on one NUMA node
+class NumaSkipListsArena {
+    private:
+        int node;
+
+        std::vector<std::pair<char*, size_t> > chunks;
+        char* next;
+        size_t left;
+
+    public:
+        NumaSkipListsArena(int numa_node) : node(numa_node), next(NULL), left(0) {
+        }
+
+        ~NumaSkipListsArena() {
+            for (size_t i = 0; i < chunks.size(); ++i) {
+                munmap(chunks[i].first, chunks[i].second);
+            }
+        }
+
+        void* allocate(size_t bytes) {
+            bytes = (bytes + 15) & ~(size_t)15;
+            if (bytes > left) {
+                size_t len = bytes > NUMA_SKIPLISTS_CHUNK ? bytes : NUMA_SKIPLISTS_CHUNK;
+                void* p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p == MAP_FAILED) {
+                    return NULL;
+                }
+                numa_skiplists_bind(p, len, node);
+                chunks.push_back(std::make_pair((char*)p, len));
+                next = (char*)p;
+                left = len;
+            }
+
+            void* p = next;
+            next += bytes;
+            left -= bytes;
+            return p;
+        }
+};
+
+
+template<typename KeyType, typename ValType>
+struct NumaSkipListsBottom {
+    KeyType key;
+    ValType value;
+
+    NumaSkipListsBottom* next;
+};
+
+// a tower's levels 1 and up, followed in memory by height - 1 forward
+// pointers; forward[j] is level j + 1
+template<typename KeyType, typename ValType>
+struct NumaSkipListsIndex {
+    KeyType key;
+    NumaSkipListsBottom<KeyType, ValType>* bottom;
+    int height;
+};
+
+
+// Skip lists for read-heavy use on NUMA machines.
+//
+// Level 0, which holds every key and value, is shared and interleaved over
+// all nodes. The upper levels, about a third of the links at p = 1/4, are
+// copied once per replica, each replica's nodes (keys included) placed on
+// its own NUMA node with mbind(2). find() searches the replica of the
+// node it runs on, so only the last few level-0 hops may leave the socket.
+// By default there is one replica per node; on a single-node machine that
+// is one replica and no mbind() at all. Tests may force more replicas.
+//
+// Writes go to every replica and, as with SkipLists, must not run
+// concurrently with anything else; concurrent find()s are fine.
+template<typename KeyType, typename ValType>
+class NumaSkipLists {
+    static_assert(std::is_trivially_copyable<KeyType>::value && std::is_trivially_copyable<ValType>::value,
+                  "NumaSkipLists keeps nodes in raw mapped memory");
+
+    private:
+        typedef NumaSkipListsBottom<KeyType, ValType> Bottom;
+        typedef NumaSkipListsIndex<KeyType, ValType> Index;
+
+        struct Replica {
+            NumaSkipListsArena arena;
+            Index* header;
+
+            // removed index nodes, chained through forward[0], by height
+            std::vector<Index*> free_nodes;
+
+            Replica(int node) : arena(node), header(NULL) {
+            }
+        };
+
+        // maximum level of this list
+        // level = 0 of the list is empty
+        int level;
+
+        // the upper bound
+        int max_number_of_levels;
+
+        SkipListsLevelGenerator levels;
+
+        // number of elements
+        size_t count;
+
+        NumaSkipListsArena bottom_arena;
+        Bottom* head;
+        Bottom* free_bottoms;
+
+        std::vector<Replica*> replicas;
+
+        // NUMA node id -> the replica find() uses there
+        std::vector<int> replica_of_node;
+
+        static Index** forward(Index* x) {
+            return (Index**)(x + 1);
+        }
+
+        Index* allocate_index(Replica* r, int height) {
+            Index* x = r->free_nodes[height];
+            if (x != NULL) {
+                r->free_nodes[height] = forward(x)[0];
+            } else {
+                x = (Index*)r->arena.allocate(sizeof(Index) + (height - 1) * sizeof(Index*));
+                if (x == NULL) {
+                    return NULL;
+                }
+            }
+            x->height = height;
+            for (int j = 0; j < height - 1; ++j) {
+                forward(x)[j] = NULL;
+            }
+            return x;
+        }
+
+        void free_index(Replica* r, Index* x) {
+            forward(x)[0] = r->free_nodes[x->height];
+            r->free_nodes[x->height] = x;
+        }
+
+        // unlink and free the tower of key in r, if it has one; update[]
+        // as filled by search()
+        void unlink_tower(Replica* r, const KeyType& key, Index** update) {
+            Index* x = NULL;
+            for (int j = 0; j < level - 1; ++j) {
+                Index* q = forward(update[j])[j];
+                if (q != NULL && q->key == key) {
+                    forward(update[j])[j] = forward(q)[j];
+                    x = q;
+                }
+            }
+            if (x != NULL) {
+                free_index(r, x);
+            }
+        }
+
+        // Search the upper levels of r, filling update[j] with the last
+        // node before key on level j + 1, then level 0; returns the last
+        // level-0 node before key, head if none.
+        Bottom* search(const Replica* r, const KeyType& key, Index** update) const {
+            Index* p = r->header;
+            for (int j = level - 2; j >= 0; --j) {
+                Index* q;
+                while ((q = forward(p)[j]) != NULL && q->key < key) {
+                    p = q;
+                }
+                if (update != NULL) {
+                    update[j] = p;
+                }
+            }
+
+            Bottom* b = p == r->header ? head : p->bottom;
+            while (b->next != NULL && b->next->key < key) {
+                b = b->next;
+            }
+            return b;
+        }
+
+    public:
+        // replicas = 0 gives one replica per NUMA node; replica i goes on
+        // the i-th of node_ids, round robin when there are more replicas
+        NumaSkipLists(int max_level_num = 16, int replica_count = 0,
+                      const std::vector<int>& node_ids = numa_skiplists_node_ids()) :
+            level(0), max_number_of_levels(max_level_num), levels(max_level_num),
+            count(0), bottom_arena(-1), free_bottoms(NULL) {
+                head = (Bottom*)bottom_arena.allocate(sizeof(Bottom));
+                assert(head != NULL);
+                head->next = NULL;
+
+                int nodes = (int)node_ids.size();
+                assert(nodes > 0);
+                if (replica_count <= 0) {
+                    replica_count = nodes;
+                }
+
+                // with fewer replicas than nodes, nodes share them round robin
+                replica_of_node.resize(*std::max_element(node_ids.begin(), node_ids.end()) + 1, 0);
+                for (int j = 0; j < nodes; ++j) {
+                    replica_of_node[node_ids[j]] = j % replica_count;
+                }
+
+                for (int i = 0; i < replica_count; ++i) {
+                    Replica* r = new Replica(node_ids[i % nodes]);
+                    r->free_nodes.resize(max_number_of_levels + 1, NULL);
+                    r->header = allocate_index(r, max_number_of_levels);
+                    assert(r->header != NULL);
+                    r->header->bottom = head;
+                    replicas.push_back(r);
+                }
+        }
+
+        ~NumaSkipLists() {
+            for (size_t i = 0; i < replicas.size(); ++i) {
+                delete replicas[i];
+            }
+        }
+
+        // see SkipLists::seed_levels()
+        void seed_levels(uint64_t seed) {
+            levels.seed(seed);
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        int replica_count() const {
+            return (int)replicas.size();
+        }
+
+        // the replica find() uses on node, 0 for a node it does not know
+        int replica_of(int node) const {
+            return node >= 0 && node < (int)replica_of_node.size() ? replica_of_node[node] : 0;
+        }
+
+        // the replica find() uses on the calling thread
+        int local_replica() const {
+            return replica_of(numa_skiplists_current_node());
+        }
+
+        void print() {
+            for (int j = level - 2; j >= 0; --j) {
+                for (Index* p = forward(replicas[0]->header)[j]; p != NULL; p = forward(p)[j]) {
+                    std::cout << p->key << ":" << p->bottom->value << " ";
+                }
+                std::cout << std::endl;
+            }
+            for (Bottom* b = head->next; b != NULL; b = b->next) {
+                std::cout << b->key << ":" << b->value << " ";
+            }
+            std::cout << std::endl;
+        }
+
+        bool insert(const KeyType& key, const ValType& value) {
+            Index* update[max_number_of_levels];
+            Bottom* b = search(replicas[0], key, update);
+
+            if (b->next != NULL && b->next->key == key) {
+                b->next->value = value;
+                // insert the same value
+                return false;
+            }
+
+            Bottom* q = free_bottoms;
+            if (q != NULL) {
+                free_bottoms = q->next;
+            } else {
+                q = (Bottom*)bottom_arena.allocate(sizeof(Bottom));
+                if (q == NULL) {
+                    // out of memory
+                    return false;
+                }
+            }
+            q->key = key;
+            q->value = value;
+            q->next = b->next;
+            b->next = q;
+
+            int h = levels.next();
+            bool grew = false;
+            if (h > level) {
+                h = ++level;
+                grew = true;
+            }
+
+            for (size_t i = 0; i < replicas.size() && h > 1; ++i) {
+                Replica* r = replicas[i];
+                if (i > 0) {
+                    search(r, key, update);
+                }
+                // a new top level starts at the header
+                if (grew) {
+                    update[h-2] = r->header;
+                }
+
+                Index* x = allocate_index(r, h);
+                if (x == NULL) {
+                    // out of memory: every replica must hold the same
+                    // towers, so take the key back out of those done
+                    for (size_t k = 0; k < i; ++k) {
+                        search(replicas[k], key, update);
+                        unlink_tower(replicas[k], key, update);
+                    }
+                    b->next = q->next;
+                    q->next = free_bottoms;
+                    free_bottoms = q;
+                    if (grew) {
+                        --level;
+                    }
+                    return false;
+                }
+                x->key = key;
+                x->bottom = q;
+                for (int j = 0; j < h - 1; ++j) {
+                    forward(x)[j] = forward(update[j])[j];
+                    forward(update[j])[j] = x;
+                }
+            }
+
+            ++count;
+
+            return true;
+        }
+
+        bool remove(const KeyType& key) {
+            Index* update[max_number_of_levels];
+
+            for (size_t i = replicas.size(); i-- > 0; ) {
+                Replica* r = replicas[i];
+                Bottom* b = search(r, key, update);
+                if (b->next == NULL || !(b->next->key == key)) {
+                    return false;
+                }
+
+                unlink_tower(r, key, update);
+
+                if (i == 0) {
+                    Bottom* q = b->next;
+                    b->next = q->next;
+                    q->next = free_bottoms;
+                    free_bottoms = q;
+                }
+            }
+
+            while (level > 1 && forward(replicas[0]->header)[level-2] == NULL) {
+                --level;
+            }
+            if (--count == 0) {
+                level = 0;
+            }
+
+            return true;
+        }
+
+        bool find(const KeyType& key, ValType& res) const {
+            return find(key, res, local_replica());
+        }
+
+        // through a given replica, for tests
+        bool find(const KeyType& key, ValType& res, int replica) const {
+            Bottom* b = search(replicas[replica], key, NULL);
+
+            if (b->next != NULL && b->next->key == key) {
+                res = b->next->value;
+                return true;
+            }
+
+            return false;
+        }
+
+        // level 0 is sorted and counted, and every replica indexes the
+        // same towers over it
+        bool check_invariants() const {
+            size_t n = 0;
+            for (Bottom* b = head->next; b != NULL; b = b->next, ++n) {
+                if (b->next != NULL && !(b->key < b->next->key)) {
+                    return false;
+                }
+            }
+            if (n != count || (count == 0) != (level == 0)) {
+                return false;
+            }
+
+            for (size_t i = 0; i < replicas.size(); ++i) {
+                for (int j = 0; j < max_number_of_levels - 1; ++j) {
+                    Index* p = forward(replicas[i]->header)[j];
+                    Index* p0 = forward(replicas[0]->header)[j];
+                    if (j >= level - 1 && p != NULL) {
+                        return false;
+                    }
+
+                    Bottom* b = head->next;
+                    for (; p != NULL; p = forward(p)[j], p0 = forward(p0)[j]) {
+                        if (p0 == NULL || !(p->key == p0->key) || p->height <= j + 1) {
+                            return false;
+                        }
+                        // the tower stands on a live level-0 node
+                        while (b != NULL && b != p->bottom) {
+                            b = b->next;
+                        }
+                        if (b == NULL || !(b->key == p->key)) {
+                            return false;
+                        }
+                    }
+                    if (p0 != NULL) {
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+        }
+};
+
+#endif
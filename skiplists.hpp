@@ -2,15 +2,121 @@
 #define _SKIP_LISTS_HPP
 
 #include <vector>
+#include <utility>
 #include <assert.h>
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <time.h>
 
 #define BITSINRANDOM 31
 
 
-template<typename KeyType, typename ValType>
-struct SkipListsNode {
+// milliseconds on some monotonic clock
+typedef int64_t (*SkipListsClock)();
+
+inline int64_t skiplists_monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// how a list picks the height of its towers
+enum SkipListsBalance {
+    // Pugh's coin flips, p = 1/4: fast on average, no worst-case bound
+    RANDOMIZED_LEVELS,
+
+    // Munro-Papadakis-Sedgewick 1-2-3 skip list: between two adjacent
+    // nodes of height > h there are 1 to 3 nodes of height h, so a search
+    // takes at most 4 hops per level and O(log n) in the worst case
+    DETERMINISTIC_LEVELS
+};
+
+// Pugh's tower heights, p = 1/4, two random bits per coin flip; every
+// list draws its heights from one of these. Each generator has its own
+// xorshift64* state, seeded from the clock and its address unless seed()
+// is called, so the global rand() is neither used nor reseeded and a
+// fixed seed gives the same towers on every run.
+class SkipListsLevelGenerator {
+    private:
+        // max_number_of_levels - 1
+        int max_level;
+
+        int randoms_left;
+        uint32_t random_bits;
+
+        uint64_t state;
+
+    public:
+        explicit SkipListsLevelGenerator(int max_level_num) :
+            max_level(max_level_num - 1), randoms_left(0), random_bits(0) {
+                seed((uint64_t)time(NULL) ^ (uintptr_t)this);
+        }
+
+        void seed(uint64_t s) {
+            // splitmix64, so that nearby seeds give unrelated states
+            s += 0x9e3779b97f4a7c15ULL;
+            s = (s ^ (s >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            s = (s ^ (s >> 27)) * 0x94d049bb133111ebULL;
+            s ^= s >> 31;
+            state = s ? s : 1;
+            randoms_left = 0;
+        }
+
+        uint64_t random() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 0x2545f4914f6cdd1dULL;
+        }
+
+        int next() {
+            int l = 1;
+            int b;
+            do {
+                if (randoms_left == 0) {
+                    random_bits = (uint32_t)(random() >> (64 - BITSINRANDOM));
+                    randoms_left = BITSINRANDOM / 2;
+                }
+                b = random_bits & 3;
+                if (!b) l++;
+                random_bits >>= 2;
+                --randoms_left;
+            } while(!b);
+
+            return (l > max_level ? max_level : l);
+        }
+};
+
+// the expiry stamp of a node, only in lists built with TTLs; the others
+// do not pay for it
+template<bool Expiring>
+struct SkipListsExpiry {
+    // when the entry expires, 0 for never
+    int64_t expire_at;
+
+    int64_t expiry() const {
+        return expire_at;
+    }
+
+    void set_expire_at(int64_t t) {
+        expire_at = t;
+    }
+};
+
+template<>
+struct SkipListsExpiry<false> {
+    int64_t expiry() const {
+        return 0;
+    }
+
+    void set_expire_at(int64_t) {
+    }
+};
+
+template<typename KeyType, typename ValType, bool Expiring = false>
+struct SkipListsNode : SkipListsExpiry<Expiring> {
     KeyType key;
     ValType value;
 
@@ -18,7 +124,10 @@ struct SkipListsNode {
 };
 
 
-template<typename KeyType, typename ValType>
+// Expiring = true adds the TTL API (insert() with a ttl, insert_expiring())
+// at 8 bytes per node; without it expired() is constant false and nodes
+// carry no stamp.
+template<typename KeyType, typename ValType, bool Expiring = false>
 class SkipLists {
     private:
         // maximum level of this list 
@@ -27,34 +136,321 @@ class SkipLists {
 
         // the upper bound
         int max_number_of_levels;
-        
-        // max_number_of_levels - 1
-        int max_level;
 
-        int randoms_left;
-        int random_bits;
+        SkipListsLevelGenerator levels;
+
+        SkipListsBalance balance;
+
+        // number of elements
+        size_t count;
 
         // pointer to header
-        SkipListsNode<KeyType, ValType> * header;
+        SkipListsNode<KeyType, ValType, Expiring> * header;
+
+        // sentinel ending every level, greater than any key; it is never
+        // compared, see advance()
+        SkipListsNode<KeyType, ValType, Expiring> * tail;
+
+        // entries with a TTL ordered by (expire_at, node address), created
+        // on the first insert with a TTL; keying by address rather than by
+        // key gives every list the same index type
+        SkipLists<std::pair<int64_t, uintptr_t>, char>* expiry_index;
+
+        SkipListsClock clock;
+
+        bool expired(const SkipListsNode<KeyType, ValType, Expiring>* x) const {
+            return Expiring && x->expiry() != 0 && x->expiry() <= clock();
+        }
+
+        // drop x from the expiry index
+        void forget_expiry(SkipListsNode<KeyType, ValType, Expiring>* x) {
+            if (x->expiry() != 0) {
+                expiry_index->remove(std::make_pair(x->expiry(), (uintptr_t)x));
+                x->set_expire_at(0);
+            }
+        }
+
+        void set_expiry(SkipListsNode<KeyType, ValType, Expiring>* x, int64_t expire_at) {
+            forget_expiry(x);
+            if (expire_at != 0) {
+                if (expiry_index == NULL) {
+                    // towers from this list's generator, so a seeded list
+                    // builds the same index every run
+                    expiry_index = new SkipLists<std::pair<int64_t, uintptr_t>, char>(max_number_of_levels);
+                    expiry_index->seed_levels(levels.random());
+                }
+                x->set_expire_at(expire_at);
+                expiry_index->insert(std::make_pair(expire_at, (uintptr_t)x), 0);
+            }
+        }
+
+        static int height(const SkipListsNode<KeyType, ValType, Expiring>* x) {
+            return (int)x->forward.size();
+        }
+
+        // Walk level k from p while the next node is less than key, leave p
+        // on the last such node and return the next one. last is where the
+        // level above stopped: a node known not to be less than key, so it
+        // is not compared again (Pugh's "don't re-compare"). A search starts
+        // with last = tail, which ends the walk without a NULL check.
+        SkipListsNode<KeyType, ValType, Expiring>* advance(SkipListsNode<KeyType, ValType, Expiring>*& p, int k, const KeyType& key,
+                                                 SkipListsNode<KeyType, ValType, Expiring>* last) const {
+            SkipListsNode<KeyType, ValType, Expiring>* q;
+            while (q = p->forward[k], q != last && q->key < key) {
+                p = q;
+            }
+            return q;
+        }
+
+        // top-down search shared by find, insert and remove: returns the
+        // first node not less than key, or tail, and when update is given
+        // fills update[k] with the last node before key on level k
+        SkipListsNode<KeyType, ValType, Expiring>* search(const KeyType& key, SkipListsNode<KeyType, ValType, Expiring>** update) const {
+            SkipListsNode<KeyType, ValType, Expiring>* p = header;
+            SkipListsNode<KeyType, ValType, Expiring>* q = tail;
+
+            for (int k = level - 1; k >= 0; --k) {
+                q = advance(p, k, key, q);
+                if (update != NULL) {
+                    update[k] = p;
+                }
+            }
+
+            return q;
+        }
+
+        // finish an insert after search() left update[] and q at key: set
+        // q if it holds key, else link a new tower after update[], which
+        // then points at it so a following larger key can start there
+        bool link(const KeyType& key, const ValType& value, int64_t expire_at,
+                  SkipListsNode<KeyType, ValType, Expiring>** update, SkipListsNode<KeyType, ValType, Expiring>* q) {
+            int k;
+            SkipListsNode<KeyType, ValType, Expiring>* p;
+
+            if (q != tail && q->key == key) {
+                bool was_expired = expired(q);
+                q->value = value;
+                set_expiry(q, expire_at);
+                // insert the same value
+                return was_expired;
+            }
+
+            k = levels.next();
+            if (k > level) {
+                k = ++level;
+                // update index from 0
+                update[k-1] = header;
+            }
+            q = new SkipListsNode<KeyType, ValType, Expiring>();
+            q->forward.resize(k, tail);
+            q->key = key;
+            q->value = value;
+            set_expiry(q, expire_at);
+
+            while ( --k >= 0 ) {
+                p = update[k];
+                q->forward[k] = p->forward[k];
+                p->forward[k] = q;
+                update[k] = q;
+            }
+
+
+            ++count;
+
+            return true;
+        }
+
+        // 1-2-3 insertion: on the way down, split every gap of 3 by raising
+        // its middle node, so the bottom gap always has room for one more
+        bool insert_deterministic(const KeyType& key, const ValType& value, int64_t expire_at) {
+            SkipListsNode<KeyType, ValType, Expiring>* p = header;
+            SkipListsNode<KeyType, ValType, Expiring>* q = tail;
+
+            for (int k = level; k >= 1; --k) {
+                // the gap at level k is the whole top list for k == level
+                if (k < level) {
+                    q = advance(p, k, key, q);
+                }
+
+                if (k == max_number_of_levels) {
+                    // no room to grow, let the top gap overflow
+                    continue;
+                }
+
+                SkipListsNode<KeyType, ValType, Expiring>* end = p->forward[k];
+                SkipListsNode<KeyType, ValType, Expiring>* a = p->forward[k-1];
+                SkipListsNode<KeyType, ValType, Expiring>* b;
+                if (a == end || (b = a->forward[k-1]) == end || b->forward[k-1] == end) {
+                    continue;
+                }
+
+                // three or more: raise the second one
+                b->forward.resize(k + 1, NULL);
+                b->forward[k] = end;
+                p->forward[k] = b;
+                if (k == level) {
+                    ++level;
+                }
+
+                if (b->key < key) {
+                    p = b;
+                } else {
+                    q = b;
+                }
+            }
+
+            q = advance(p, 0, key, q);
+
+            if (q != tail && q->key == key) {
+                bool was_expired = expired(q);
+                q->value = value;
+                set_expiry(q, expire_at);
+                // insert the same value
+                return was_expired;
+            }
+
+            q = new SkipListsNode<KeyType, ValType, Expiring>();
+            q->forward.resize(1, tail);
+            q->key = key;
+            q->value = value;
+            set_expiry(q, expire_at);
+
+            q->forward[0] = p->forward[0];
+            p->forward[0] = q;
+
+            if (level == 0) {
+                level = 1;
+            }
+
+            ++count;
+
+            return true;
+        }
+
+        // 1-2-3 deletion: on the way down, make sure the gap we drop into
+        // holds at least 2 nodes by borrowing from or merging with a
+        // neighbouring gap, so the bottom unlink never empties a gap
+        bool remove_deterministic(const KeyType& key) {
+            SkipListsNode<KeyType, ValType, Expiring>* p = header;
+            SkipListsNode<KeyType, ValType, Expiring>* pp;
+            SkipListsNode<KeyType, ValType, Expiring>* q = tail;
+
+            for (int k = level - 1; k >= 1; --k) {
+                SkipListsNode<KeyType, ValType, Expiring>* start = p;
+                q = advance(p, k, key, q);
+
+                // the gap below p at level k-1 ends at r
+                SkipListsNode<KeyType, ValType, Expiring>* r = p->forward[k];
+                SkipListsNode<KeyType, ValType, Expiring>* c = p->forward[k-1];
+                assert(c != r);
+                if (c->forward[k-1] != r) {
+                    continue;
+                }
+
+                if (r != tail && height(r) == k + 1) {
+                    // r sits in the same gap one level up: lower it and,
+                    // if the gap after r can spare one, raise its first
+                    SkipListsNode<KeyType, ValType, Expiring>* next = r->forward[k];
+                    SkipListsNode<KeyType, ValType, Expiring>* s = r->forward[k-1];
+
+                    p->forward[k] = next;
+                    r->forward.resize(k);
+
+                    if (s->forward[k-1] != next) {
+                        s->forward.resize(k + 1, NULL);
+                        s->forward[k] = next;
+                        p->forward[k] = s;
+                    }
+                } else {
+                    // p is the last of its gap one level up: lower p and,
+                    // if the gap before p can spare one, raise its last
+                    assert(p != start);
+                    for (pp = start; pp->forward[k] != p; pp = pp->forward[k]) {
+                    }
+                    SkipListsNode<KeyType, ValType, Expiring>* s = pp->forward[k-1];
+
+                    pp->forward[k] = r;
+                    p->forward.resize(k);
+
+                    if (s->forward[k-1] != p) {
+                        while (s->forward[k-1] != p) {
+                            s = s->forward[k-1];
+                        }
+                        s->forward.resize(k + 1, NULL);
+                        s->forward[k] = r;
+                        pp->forward[k] = s;
+                        p = s;
+                    } else {
+                        p = pp;
+                    }
+                }
+            }
+
+            SkipListsNode<KeyType, ValType, Expiring>* start = p;
+            q = advance(p, 0, key, q);
+
+            bool found = (q != tail && q->key == key);
+            if (found) {
+                --count;
+                forget_expiry(q);
+                if (height(q) == 1) {
+                    p->forward[0] = q->forward[0];
+                    delete q;
+                } else {
+                    // q is a tower and p, its predecessor, is a height-1
+                    // node: move p into q's tower and unlink p instead
+                    assert(p != start && height(p) == 1);
+                    for (pp = start; pp->forward[0] != p; pp = pp->forward[0]) {
+                    }
+                    int64_t expire_at = p->expiry();
+                    forget_expiry(p);
+                    q->key = p->key;
+                    q->value = p->value;
+                    set_expiry(q, expire_at);
+                    pp->forward[0] = q;
+                    delete p;
+                }
+            }
+
+            while (level > 0 && header->forward[level-1] == tail) {
+                --level;
+            }
+
+            return found;
+        }
+
+        bool insert_at(const KeyType& key, const ValType& value, int64_t expire_at) {
+            if (balance == DETERMINISTIC_LEVELS) {
+                return insert_deterministic(key, value, expire_at);
+            }
+
+            SkipListsNode<KeyType, ValType, Expiring>* update[max_number_of_levels];
+            SkipListsNode<KeyType, ValType, Expiring>* q = search(key, update);
+
+            return link(key, value, expire_at, update, q);
+        }
+
+        // the coroutine lookup in async_skiplists.hpp walks the levels itself
+        template<typename K, typename V, bool E> friend struct SkipListsAsync;
 
     public:
         // ctor
-        SkipLists(int max_level_num = 16) : 
-            level(0), max_number_of_levels(max_level_num), max_level(max_number_of_levels - 1), randoms_left(BITSINRANDOM/2) {
-                header = new SkipListsNode<KeyType, ValType>();
+        SkipLists(int max_level_num = 16, SkipListsBalance balance_mode = RANDOMIZED_LEVELS) : 
+            level(0), max_number_of_levels(max_level_num), levels(max_level_num),
+            balance(balance_mode), count(0), expiry_index(NULL), clock(skiplists_monotonic_ms) {
+                header = new SkipListsNode<KeyType, ValType, Expiring>();
                 assert(header != NULL);
+                tail = new SkipListsNode<KeyType, ValType, Expiring>();
+                assert(tail != NULL);
 
-                header->forward.resize(max_number_of_levels, NULL);
-                // init the seed
-                srand(time(NULL));
-                random_bits = rand() % BITSINRANDOM + 1;
+                header->forward.resize(max_number_of_levels, tail);
         }
 
         // destructor
         ~SkipLists() {
-            SkipListsNode<KeyType, ValType>* p = header->forward[0];
-            while(p != NULL) {
-                SkipListsNode<KeyType, ValType>* next = p->forward[0];
+            SkipListsNode<KeyType, ValType, Expiring>* p = header->forward[0];
+            while(p != tail) {
+                SkipListsNode<KeyType, ValType, Expiring>* next = p->forward[0];
                 delete p;
                 p = next;
             }
@@ -62,34 +458,27 @@ class SkipLists {
             header->forward.clear();
             
             delete header;
+            delete tail;
+            delete expiry_index;
         }
         
-        // generate radom level
         int random_level() {
-            int l = 1;
-            int b;
-            do {
-                b = random_bits & 3;
-                if (!b) l++;
-                random_bits >>= 2;
-                if (--randoms_left == 0) {
-                    random_bits = rand() % BITSINRANDOM + 1;
-                    randoms_left = BITSINRANDOM / 2;
-                }
-
-            } while(!b);
-            
-            return (l > max_level ? max_level : l);
+            return levels.next();
+        }
 
+        // draw the tower heights from a fixed sequence, for lists whose
+        // shape must be the same on every run
+        void seed_levels(uint64_t seed) {
+            levels.seed(seed);
         }
 
         void print() {
-            SkipListsNode<KeyType, ValType> * p;
+            SkipListsNode<KeyType, ValType, Expiring> * p;
 
             for(int i=level-1; i>=0; i--) { // for each level
                 p = header->forward[i];
 
-                while (p != NULL) {
+                while (p != tail) {
                     std::cout << p->key << ":" << p->value << " ";
                     p = p->forward[i];
                 }
@@ -100,106 +489,396 @@ class SkipLists {
         }        
 
         bool insert(const KeyType& key, const ValType& value) {
-            int k = level;
+            return insert_at(key, value, 0);
+        }
 
-            SkipListsNode<KeyType, ValType>* update[max_number_of_levels];
-            SkipListsNode<KeyType, ValType>* p = header;
-            SkipListsNode<KeyType, ValType>* q;
+        // insert an entry that find() stops seeing ttl_ms from now
+        bool insert(const KeyType& key, const ValType& value, int64_t ttl_ms) {
+            static_assert(Expiring, "TTLs need SkipLists<KeyType, ValType, true>");
+            return insert_at(key, value, clock() + ttl_ms);
+        }
 
-            while ( --k >= 0) {
-                while (q = p->forward[k], q != NULL && q->key < key) {
-                    p = q;
+        // insert with an absolute expiry time on clock(), 0 for never
+        bool insert_expiring(const KeyType& key, const ValType& value, int64_t expire_at) {
+            static_assert(Expiring, "TTLs need SkipLists<KeyType, ValType, true>");
+            return insert_at(key, value, expire_at);
+        }
+
+        // Insert a run of pairs, e.g. a log replay. Each search starts from
+        // the previous key's update[] (a finger): climb while the finger
+        // is behind the key, then descend as usual, so ascending input
+        // costs O(log d) per pair for a distance d between neighbours
+        // instead of O(log n). Unsorted input only loses the speed up.
+        // Returns the number of new keys.
+        size_t insert_batch(const std::vector<std::pair<KeyType, ValType> >& items) {
+            size_t added = 0;
+
+            if (balance == DETERMINISTIC_LEVELS) {
+                for (size_t i = 0; i < items.size(); ++i) {
+                    added += insert(items[i].first, items[i].second);
                 }
-                update[k] = p;
+                return added;
             }
 
-            if (q != NULL && q->key == key) {
-                q->value = value;
-                // insert the same value
-                return false;
+            SkipListsNode<KeyType, ValType, Expiring>* update[max_number_of_levels];
+            for (int k = 0; k < max_number_of_levels; ++k) {
+                update[k] = header;
             }
 
-            k = random_level();
-            if (k > level) {
-                k = ++level;
-                // update index from 0
-                update[k-1] = header;
-            }
-            q = new SkipListsNode<KeyType, ValType>();
-            if (!q) {
-                // out of memory
-                return false;
-            }
-            q->forward.resize(k, NULL);
-            q->key = key;
-            q->value = value;
+            for (size_t i = 0; i < items.size(); ++i) {
+                const KeyType& key = items[i].first;
 
-            while ( --k >= 0 ) {
-                p = update[k];
-                q->forward[k] = p->forward[k];
-                p->forward[k] = q;
-            }
+                if (i > 0 && !(items[i-1].first < key)) {
+                    // out of order or repeated: the finger may be at key
+                    // itself, start over from the header
+                    for (int k = 0; k < level; ++k) {
+                        update[k] = header;
+                    }
+                }
 
+                SkipListsNode<KeyType, ValType, Expiring>* q = tail;
+                if (level > 0) {
+                    int k = 0;
+                    while (k < level - 1 && (q = update[k]->forward[k]) != tail && q->key < key) {
+                        ++k;
+                    }
+
+                    // levels above k still hold the predecessors of key
+                    SkipListsNode<KeyType, ValType, Expiring>* p = update[k];
+                    q = tail;
+                    for (; k >= 0; --k) {
+                        q = advance(p, k, key, q);
+                        update[k] = p;
+                    }
+                }
 
-            return true;
+                added += link(key, items[i].second, 0, update, q);
+            }
+
+            return added;
         }
 
         bool remove(const KeyType& key) {
-            SkipListsNode<KeyType, ValType>* update[max_number_of_levels];
-            SkipListsNode<KeyType, ValType>* p = header;
-            SkipListsNode<KeyType, ValType>* q;
+            if (balance == DETERMINISTIC_LEVELS) {
+                return remove_deterministic(key);
+            }
 
-            int k = level;
+            SkipListsNode<KeyType, ValType, Expiring>* update[max_number_of_levels];
+            SkipListsNode<KeyType, ValType, Expiring>* p;
 
             // search first
-            while (--k >= 0) {
-                while (q = p->forward[k], q->key < key) {
-                    p = q;
-                }
+            SkipListsNode<KeyType, ValType, Expiring>* q = search(key, update);
 
-                update[k] = p;
-            }
-
-            if ((q != NULL) && (q->key == key)) {
+            if (q != tail && q->key == key) {
                 for(int i=0; (i<level) && (update[i]->forward[i] == q); ++i) {
                     p = update[i];
-                    assert(p->forward[i]->key == key);
                     p->forward[i] = q->forward[i];
                 }
 
+                forget_expiry(q);
                 delete q;
 
                 int m = level;
-                while ( header->forward[m-1] == NULL && m >= 0) {
+                while (m > 0 && header->forward[m-1] == tail) {
                     --m;
                 }
 
                 level = m;
 
+                --count;
+
                 return true;
             }
 
             return false;
         }
 
+        // an expired entry is a miss, and is reclaimed on the spot
         bool find(const KeyType& key, ValType& res) {
-            SkipListsNode<KeyType, ValType>* p = header;
-            SkipListsNode<KeyType, ValType>* q;
+            SkipListsNode<KeyType, ValType, Expiring>* q = search(key, NULL);
 
-            int k = level;
-            while (--k >= 0) {
-                while (q = p->forward[k], q->key < key) {
-                    p = q;
+            if (q != tail && q->key == key) {
+                if (expired(q)) {
+                    remove(key);
+                    return false;
                 }
-            }
-
-            if (q != NULL && q->key == key) {
                 res = q->value;
                 return true;
             }
 
             return false;
         }
+
+        // reclaim at most budget expired entries, oldest first; returns
+        // how many went
+        size_t evict_expired(size_t budget) {
+            size_t n = 0;
+
+            if (expiry_index == NULL) {
+                return 0;
+            }
+
+            int64_t now = clock();
+            std::pair<int64_t, uintptr_t> e;
+            char c;
+            while (n < budget && expiry_index->front(e, c) && e.first <= now) {
+                KeyType key = ((SkipListsNode<KeyType, ValType, Expiring>*)e.second)->key;
+                remove(key);
+                ++n;
+            }
+
+            return n;
+        }
+
+        // use another clock for TTLs, in milliseconds
+        void set_clock(SkipListsClock c) {
+            clock = c;
+        }
+
+        // smallest unexpired element
+        bool front(KeyType& key, ValType& value) const {
+            SkipListsNode<KeyType, ValType, Expiring>* q = header->forward[0];
+
+            while (q != tail && expired(q)) {
+                q = q->forward[0];
+            }
+            if (q == tail) {
+                return false;
+            }
+
+            key = q->key;
+            value = q->value;
+            return true;
+        }
+
+        // remove the smallest element: it is first on every level it is on,
+        // so unlinking it only touches header->forward[], no search needed;
+        // expired elements on the way are dropped
+        bool pop_front(KeyType& key, ValType& value) {
+            SkipListsNode<KeyType, ValType, Expiring>* q;
+            bool live;
+
+            do {
+                q = header->forward[0];
+                if (q == tail) {
+                    return false;
+                }
+
+                key = q->key;
+                value = q->value;
+                live = !expired(q);
+
+                if (balance == DETERMINISTIC_LEVELS) {
+                    // the gaps along the left edge need rebalancing, which
+                    // costs one compare per level
+                    remove_deterministic(key);
+                    continue;
+                }
+
+                for (int k = 0; k < height(q); ++k) {
+                    header->forward[k] = q->forward[k];
+                }
+                forget_expiry(q);
+                delete q;
+
+                while (level > 0 && header->forward[level-1] == tail) {
+                    --level;
+                }
+
+                --count;
+            } while (!live);
+
+            return true;
+        }
+
+        // remove up to n smallest elements in order, appending them to out;
+        // the header is fixed up once for the whole batch
+        size_t pop_front_batch(size_t n, std::vector<std::pair<KeyType, ValType> >& out) {
+            size_t popped = 0;
+
+            if (balance == DETERMINISTIC_LEVELS) {
+                KeyType key;
+                ValType value;
+                while (popped < n && pop_front(key, value)) {
+                    out.push_back(std::make_pair(key, value));
+                    ++popped;
+                }
+                return popped;
+            }
+
+            SkipListsNode<KeyType, ValType, Expiring>* q = header->forward[0];
+            size_t unlinked = 0;
+            while (popped < n && q != tail) {
+                SkipListsNode<KeyType, ValType, Expiring>* next = q->forward[0];
+
+                if (!expired(q)) {
+                    out.push_back(std::make_pair(q->key, q->value));
+                    ++popped;
+                }
+                // the last popped node on each level links past the batch
+                for (int k = 0; k < height(q); ++k) {
+                    header->forward[k] = q->forward[k];
+                }
+                forget_expiry(q);
+                delete q;
+
+                q = next;
+                ++unlinked;
+            }
+
+            while (level > 0 && header->forward[level-1] == tail) {
+                --level;
+            }
+
+            count -= unlinked;
+
+            return popped;
+        }
+
+        // expired entries count until evict_expired() or an access to
+        // them reclaims them
+        size_t size() const {
+            return count;
+        }
+
+        // read-only forward iterator over level 0, skips expired entries
+        class iterator {
+            private:
+                const SkipLists* list;
+                const SkipListsNode<KeyType, ValType, Expiring>* node;
+
+                void skip_expired() {
+                    while (node != list->tail && list->expired(node)) {
+                        node = node->forward[0];
+                    }
+                }
+
+            public:
+                iterator() : list(NULL), node(NULL) {}
+
+                iterator(const SkipLists* l, const SkipListsNode<KeyType, ValType, Expiring>* n) : list(l), node(n) {
+                    skip_expired();
+                }
+
+                const KeyType& key() const {
+                    return node->key;
+                }
+
+                const ValType& value() const {
+                    return node->value;
+                }
+
+                iterator& operator++() {
+                    node = node->forward[0];
+                    skip_expired();
+                    return *this;
+                }
+
+                bool operator==(const iterator& other) const {
+                    return node == other.node;
+                }
+
+                bool operator!=(const iterator& other) const {
+                    return node != other.node;
+                }
+        };
+
+        iterator begin() const {
+            return iterator(this, header->forward[0]);
+        }
+
+        iterator end() const {
+            return iterator(this, tail);
+        }
+
+        // first unexpired element whose key is not less than key
+        iterator lower_bound(const KeyType& key) const {
+            return iterator(this, search(key, NULL));
+        }
+
+        // check that every list is sorted, that each list is a sublist of
+        // the one below made of the nodes tall enough for it, and that
+        // level counts the non-empty lists, that size() and the expiry
+        // index agree with level 0; in DETERMINISTIC_LEVELS mode also that
+        // every gap holds 1 to 3 nodes
+        bool check_invariants() {
+            SkipListsNode<KeyType, ValType, Expiring>* p;
+
+            size_t nodes = 0;
+            size_t expiring = 0;
+            for (p = header->forward[0]; p != tail; p = p->forward[0]) {
+                ++nodes;
+                expiring += (p->expiry() != 0);
+            }
+            if (nodes != count || expiring != (expiry_index != NULL ? expiry_index->size() : 0)) {
+                return false;
+            }
+
+            if (level < 0 || level > max_number_of_levels) {
+                return false;
+            }
+            if (level > 0 && header->forward[level-1] == tail) {
+                return false;
+            }
+            for (int k = level; k < max_number_of_levels; ++k) {
+                if (header->forward[k] != tail) {
+                    return false;
+                }
+            }
+
+            for (int k = 0; k < level; ++k) {
+                SkipListsNode<KeyType, ValType, Expiring>* below = (k > 0) ? header->forward[k-1] : tail;
+                // nodes of height exactly k+1 since the last taller one
+                int gap = 0;
+
+                for (p = header->forward[k]; p != tail; p = p->forward[k]) {
+                    if (height(p) <= k || height(p) > max_number_of_levels) {
+                        return false;
+                    }
+                    if (p->forward[k] != tail && !(p->key < p->forward[k]->key)) {
+                        return false;
+                    }
+
+                    if (k > 0) {
+                        // every node of list k must also be on list k-1,
+                        // and every node skipped there must be too short
+                        while (below != tail && below != p) {
+                            if (height(below) > k) {
+                                return false;
+                            }
+                            below = below->forward[k-1];
+                        }
+                        if (below == tail) {
+                            return false;
+                        }
+                        below = below->forward[k-1];
+                    }
+
+                    if (height(p) == k + 1) {
+                        ++gap;
+                    } else if (balance == DETERMINISTIC_LEVELS && (gap < 1 || gap > 3)) {
+                        return false;
+                    } else {
+                        gap = 0;
+                    }
+                }
+
+                if (k > 0) {
+                    for (; below != tail; below = below->forward[k-1]) {
+                        if (height(below) > k) {
+                            return false;
+                        }
+                    }
+                }
+
+                if (balance == DETERMINISTIC_LEVELS
+                        && (gap < 1 || (gap > 3 && k + 1 < max_number_of_levels))) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
 };
 
 #endif
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+
+#include "async_skiplists.hpp"
+
+using namespace std;
+
+
+static int64_t fake_now = 1000;
+
+static int64_t fake_clock()
+{
+    return fake_now;
+}
+
+
+// a request handler: a few lookups in a row, each one waiting for the last
+static SkipListsTask<void> handler(const SkipLists<int, int, true>& list, SkipListsScheduler& scheduler,
+                                   int key, int lookups, std::vector<int>* values)
+{
+    for (int i = 0; i < lookups; ++i) {
+        int v = -1;
+        bool r = co_await async_find(list, scheduler, key + i, v);
+        values->push_back(r ? v : -1);
+    }
+}
+
+
+// counts the copies alive, to see when task frames go
+struct Tracked {
+    static int live;
+
+    Tracked() {
+        ++live;
+    }
+
+    Tracked(const Tracked&) {
+        ++live;
+    }
+
+    ~Tracked() {
+        --live;
+    }
+};
+
+int Tracked::live = 0;
+
+// each link spawns the next one and finishes
+static SkipListsTask<void> chain(SkipListsScheduler& scheduler, Tracked t, int left, int* most_live)
+{
+    if (Tracked::live > *most_live) {
+        *most_live = Tracked::live;
+    }
+    if (left > 0) {
+        scheduler.spawn(chain(scheduler, Tracked(), left - 1, most_live));
+    }
+    co_return;
+}
+
+
+int main(int argc, char* argv[])
+{
+    cout << "spawned frames are freed as they finish" << endl;
+    {
+        SkipListsScheduler scheduler;
+        int most_live = 0;
+        scheduler.spawn(chain(scheduler, Tracked(), 1000, &most_live));
+        scheduler.run();
+        assert(most_live <= 3);
+        assert(Tracked::live == 0);
+    }
+
+    SkipListsBalance modes[] = { RANDOMIZED_LEVELS, DETERMINISTIC_LEVELS };
+    for (int m = 0; m < 2; ++m) {
+        SkipLists<int, int, true> skip_list(16, modes[m]);
+        SkipListsScheduler scheduler;
+
+        cout << "empty list" << endl;
+        std::vector<int> values;
+        scheduler.spawn(handler(skip_list, scheduler, 1, 2, &values));
+        scheduler.run();
+        assert(values.size() == 2 && values[0] == -1 && values[1] == -1);
+
+        for (int i = 0; i < 20000; i += 2) {
+            skip_list.insert(i, 2 * i);
+        }
+
+        cout << "1000 interleaved handlers" << endl;
+        std::vector<std::vector<int> > results(1000);
+        for (int i = 0; i < 1000; ++i) {
+            // some start before the first key or run past the last
+            scheduler.spawn(handler(skip_list, scheduler, (i * 37) % 20010 - 5, 3, &results[i]));
+        }
+        scheduler.run();
+
+        for (int i = 0; i < 1000; ++i) {
+            assert(results[i].size() == 3);
+            for (int j = 0; j < 3; ++j) {
+                int key = (i * 37) % 20010 - 5 + j;
+                bool hit = key >= 0 && key < 20000 && key % 2 == 0;
+                assert(results[i][j] == (hit ? 2 * key : -1));
+            }
+        }
+
+        cout << "expired entries are misses" << endl;
+        skip_list.set_clock(fake_clock);
+        skip_list.insert(20001, 7, 10);
+        fake_now += 10;
+        values.clear();
+        scheduler.spawn(handler(skip_list, scheduler, 19998, 4, &values));
+        scheduler.run();
+        assert(values.size() == 4 && values[0] == 2 * 19998 && values[3] == -1);
+        // left for find() or evict_expired() to reclaim
+        assert(skip_list.size() == 10001);
+        fake_now = 1000;
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <map>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "augmented_skiplists.hpp"
+
+using namespace std;
+
+
+// walk the reference map over [lo, hi]
+template<typename Monoid>
+static typename Monoid::value_type brute(const std::map<int, int64_t>& m, int lo, int hi)
+{
+    typename Monoid::value_type acc = Monoid::identity();
+    for (std::map<int, int64_t>::const_iterator it = m.lower_bound(lo); it != m.end() && it->first <= hi; ++it) {
+        acc = Monoid::combine(acc, it->second);
+    }
+    return acc;
+}
+
+
+int main(int argc, char* argv[])
+{
+    AugmentedSkipLists<int64_t, double> series;
+
+    cout << "sum over a time series" << endl;
+    bool r = series.insert(10, 1.5);
+    assert(r);
+    r = series.insert(20, 2.5);
+    assert(r);
+    r = series.insert(30, 4.0);
+    assert(r);
+    series.print();
+
+    assert(series.aggregate(0, 100) == 8.0);
+    assert(series.aggregate(10, 20) == 4.0);
+    assert(series.aggregate(11, 29) == 2.5);
+    assert(series.aggregate(21, 29) == 0.0);
+    assert(series.aggregate(30, 10) == 0.0);
+
+    // update in place
+    r = series.insert(20, 0.5);
+    assert(!r);
+    assert(series.aggregate(0, 100) == 6.0);
+
+    r = series.remove(10);
+    assert(r);
+    assert(series.aggregate(0, 100) == 4.5);
+    assert(series.check_invariants());
+
+    cout << "max in range" << endl;
+    AugmentedSkipLists<int64_t, double, MaxMonoid<double> > peaks;
+    assert(peaks.aggregate(0, 100) == MaxMonoid<double>::identity());
+    peaks.insert(1, 3.0);
+    peaks.insert(2, 9.0);
+    peaks.insert(3, -1.0);
+    assert(peaks.aggregate(1, 3) == 9.0);
+    assert(peaks.aggregate(3, 3) == -1.0);
+
+    cout << "non-integral sums" << endl;
+    AugmentedSkipLists<int, double> prices;
+    std::map<int, double> prices_ref;
+    srand(2);
+    for (int i = 0; i < 10000; ++i) {
+        int key = rand() % 5000;
+        double value = (rand() % 100000) / 1000.0 + 0.1;
+        prices.insert(key, value);
+        prices_ref[key] = value;
+        if (i % 4 == 3) {
+            key = rand() % 5000;
+            prices.remove(key);
+            prices_ref.erase(key);
+        }
+    }
+    assert(prices.check_invariants());
+    for (int lo = -10; lo < 5000; lo += 97) {
+        int hi = lo + 700;
+        double expected = 0;
+        for (std::map<int, double>::iterator it = prices_ref.lower_bound(lo); it != prices_ref.end() && it->first <= hi; ++it) {
+            expected += it->second;
+        }
+        double got = prices.aggregate(lo, hi);
+        assert(fabs(got - expected) <= 1e-9 * (1 + fabs(expected)));
+    }
+
+    cout << "randomized against std::map" << endl;
+    AugmentedSkipLists<int, int64_t> sums;
+    AugmentedSkipLists<int, int64_t, MinMonoid<int64_t> > mins;
+    AugmentedSkipLists<int, int64_t, MaxMonoid<int64_t> > maxs;
+    std::map<int, int64_t> ref;
+    srand(1);
+    for (int i = 0; i < 20000; ++i) {
+        int key = rand() % 2000;
+        int64_t value = rand() % 1000 - 500;
+        if (rand() % 3) {
+            sums.insert(key, value);
+            mins.insert(key, value);
+            maxs.insert(key, value);
+            ref[key] = value;
+        } else {
+            r = sums.remove(key);
+            assert(r == (ref.erase(key) == 1));
+            mins.remove(key);
+            maxs.remove(key);
+        }
+
+        int lo = rand() % 2100 - 50;
+        int hi = lo + rand() % 500;
+        assert(sums.aggregate(lo, hi) == brute<SumMonoid<int64_t> >(ref, lo, hi));
+        assert(mins.aggregate(lo, hi) == brute<MinMonoid<int64_t> >(ref, lo, hi));
+        assert(maxs.aggregate(lo, hi) == brute<MaxMonoid<int64_t> >(ref, lo, hi));
+    }
+    assert(sums.size() == ref.size());
+    assert(sums.check_invariants());
+    assert(mins.check_invariants());
+    assert(maxs.check_invariants());
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <string>
+
+#include "compact_skiplists.hpp"
+
+using namespace std;
+
+
+int main(int argc, char* argv[])
+{
+    static_assert(std::is_same<SkipListsFor<int, int>::type, CompactSkipLists<int, int> >::value,
+                  "int/int should select the compact layout");
+    static_assert(std::is_same<SkipListsFor<std::string, int>::type, SkipLists<std::string, int> >::value,
+                  "std::string keys should fall back to SkipLists");
+
+    CompactSkipLists<int, int> skip_list;
+
+    cout << "insert (1,2) (3,4) (5,6)" << endl;
+    bool r = skip_list.insert(1, 2);
+    assert(r);
+    r = skip_list.insert(3, 4);
+    assert(r);
+    r = skip_list.insert(5, 6);
+    assert(r);
+    skip_list.print();
+
+    int v = -1;
+    r = skip_list.find(3, v);
+    assert(r && v == 4);
+
+    // past the last key
+    r = skip_list.find(7, v);
+    assert(!r);
+
+    // update in place
+    r = skip_list.insert(3, 40);
+    assert(!r);
+    r = skip_list.find(3, v);
+    assert(r && v == 40);
+
+    cout << "delete key:1, key:3, key:5" << endl;
+    r = skip_list.remove(1);
+    assert(r);
+    r = skip_list.remove(3);
+    assert(r);
+    r = skip_list.remove(3);
+    assert(!r);
+    r = skip_list.remove(5);
+    assert(r);
+    assert(skip_list.size() == 0);
+    skip_list.print();
+
+    // removed nodes are recycled
+    const int n = 1000000;
+    CompactSkipLists<int, int> big;
+    big.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        int key = (int)((long long)i * 7 % n);
+        big.insert(key, key);
+    }
+    assert(big.size() == (size_t)n);
+
+    for (int i = 0; i < n; i += 2) {
+        r = big.remove(i);
+        assert(r);
+    }
+    for (int i = 0; i < n; i += 2) {
+        big.insert(i, -i);
+    }
+    for (int i = 0; i < n; ++i) {
+        r = big.find(i, v);
+        assert(r);
+        assert(i % 2 ? v == i : v == -i);
+    }
+    assert(big.check_invariants());
+    big.shrink_to_fit();
+
+    double per_element = (double)big.memory_usage() / big.size();
+    cout << "bytes per element: " << per_element << endl;
+    assert(per_element < 20);
+
+    // wider payloads
+    CompactSkipLists<long long, double> wide;
+    for (int i = 0; i < 1000; ++i) {
+        wide.insert((long long)i << 33, i * 0.5);
+    }
+    double d = 0;
+    r = wide.find((long long)500 << 33, d);
+    assert(r && d == 250.0);
+    r = wide.find(500, d);
+    assert(!r);
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+#include "concurrent_skiplists.hpp"
+
+using namespace std;
+
+
+static const int N = 20000;
+static const int READERS = 4;
+
+static std::atomic<bool> done(false);
+
+
+// every key the reader sees must carry one of the values the writer gave it
+static void reader_loop(ConcurrentSkipLists<int, int>* skip_list, long* lookups)
+{
+    ConcurrentSkipLists<int, int>::Reader reader(*skip_list);
+    unsigned int seed = 1;
+    long n = 0;
+
+    while (!done.load()) {
+        int key = rand_r(&seed) % N;
+        int v = -1;
+        if (reader.find(key, v)) {
+            assert(v == key * 2 || v == key * 3);
+        }
+        ++n;
+
+        // a whole scan inside one read-side section
+        if (n % 1000 == 0) {
+            reader.enter();
+            int last = -1;
+            for (ConcurrentSkipLists<int, int>::iterator it = skip_list->begin(); it != skip_list->end(); ++it) {
+                assert(it.key() > last);
+                last = it.key();
+            }
+            reader.exit();
+        }
+    }
+
+    *lookups = n;
+}
+
+
+static std::atomic<int> popped_total(0);
+
+// pop until all n keys are gone, counting how often each one came out
+static void consumer_loop(ConcurrentSkipLists<int, int>* skip_list, int n, std::vector<std::atomic<int> >* seen)
+{
+    ConcurrentSkipLists<int, int>::Reader reader(*skip_list);
+    int key = -1;
+    int v = -1;
+
+    while (popped_total.load() < n) {
+        if (reader.pop_front(key, v)) {
+            assert(v == key);
+            (*seen)[key].fetch_add(1);
+            popped_total.fetch_add(1);
+        }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    ConcurrentSkipLists<int, int> skip_list;
+
+    int v = -1;
+    bool r = skip_list.insert(1, 2);
+    assert(r);
+    r = skip_list.insert(1, 3);
+    assert(!r);
+    r = skip_list.find(1, v);
+    assert(r && v == 3);
+    r = skip_list.remove(1);
+    assert(r);
+    r = skip_list.find(1, v);
+    assert(!r);
+
+    cout << "1 writer, " << READERS << " readers" << endl;
+    std::vector<std::thread> readers;
+    long lookups[READERS];
+    for (int i = 0; i < READERS; ++i) {
+        readers.push_back(std::thread(reader_loop, &skip_list, &lookups[i]));
+    }
+
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < N; ++i) {
+            skip_list.insert(i, i * 2);
+        }
+        for (int i = 0; i < N; i += 3) {
+            skip_list.insert(i, i * 3);
+        }
+        for (int i = 0; i < N; i += 2) {
+            r = skip_list.remove(i);
+            assert(r);
+        }
+        skip_list.reclaim();
+    }
+
+    done.store(true);
+    long total = 0;
+    for (int i = 0; i < READERS; ++i) {
+        readers[i].join();
+        total += lookups[i];
+    }
+    cout << "lookups: " << total << endl;
+
+    skip_list.reclaim();
+    assert(skip_list.size() == (size_t)N / 2);
+    for (int i = 0; i < N; ++i) {
+        r = skip_list.find(i, v);
+        assert(r == (i % 2 == 1));
+        assert(!r || v == (i % 3 == 0 ? i * 3 : i * 2));
+    }
+
+    cout << "more readers than slots" << endl;
+    {
+        ConcurrentSkipLists<int, int> small(16, 2);
+        small.insert(1, 1);
+        ConcurrentSkipLists<int, int>::Reader* first = new ConcurrentSkipLists<int, int>::Reader(small);
+        ConcurrentSkipLists<int, int>::Reader second(small);
+        assert(first->ok() && second.ok());
+
+        {
+            ConcurrentSkipLists<int, int>::Reader third(small);
+            assert(!third.ok());
+            r = third.enter();
+            assert(!r);
+            r = third.find(1, v);
+            assert(!r);
+            int key = -1;
+            r = third.pop_front(key, v);
+            assert(!r);
+        }
+
+        // a slot comes free with its reader
+        delete first;
+        ConcurrentSkipLists<int, int>::Reader fourth(small);
+        assert(fourth.ok());
+        r = fourth.find(1, v);
+        assert(r && v == 1);
+    }
+
+    cout << "single consumer pops in order" << endl;
+    {
+        ConcurrentSkipLists<int, int> queue;
+        for (int i = 0; i < 1000; ++i) {
+            queue.insert((i * 7) % 1000, 0);
+        }
+
+        // readers that only look do not widen the spray
+        ConcurrentSkipLists<int, int>::Reader consumer(queue);
+        ConcurrentSkipLists<int, int>::Reader lookup(queue);
+        int key = -1;
+        for (int i = 0; i < 1000; ++i) {
+            r = consumer.pop_front(key, v);
+            assert(r && key == i);
+            r = lookup.find(key, v);
+            assert(!r);
+        }
+        r = consumer.pop_front(key, v);
+        assert(!r);
+        queue.purge();
+        assert(queue.size() == 0);
+    }
+
+    cout << "consumers unlink popped nodes while the writer is idle" << endl;
+    {
+        ConcurrentSkipLists<int, int> queue;
+        for (int i = 0; i < 4 * N; ++i) {
+            queue.insert(i, i);
+        }
+
+        ConcurrentSkipLists<int, int>::Reader consumer(queue);
+        int key = -1;
+        for (int i = 0; i < 4 * N; ++i) {
+            r = consumer.pop_front(key, v);
+            assert(r && key == i);
+            // the popped prefix stays short, so a pop walks few nodes
+            assert(queue.size() < (size_t)(4 * N - i - 1) + CONCURRENT_SKIPLISTS_PURGE_BATCH);
+        }
+        r = consumer.pop_front(key, v);
+        assert(!r);
+    }
+
+    cout << "purge unlinks popped nodes behind live ones" << endl;
+    {
+        ConcurrentSkipLists<int, int> queue;
+        for (int i = 0; i < 1000; ++i) {
+            queue.insert(i, i);
+        }
+
+        ConcurrentSkipLists<int, int>::Reader consumer(queue);
+        int key = -1;
+        for (int i = 0; i < 10; ++i) {
+            r = consumer.pop_front(key, v);
+            assert(r && key == i);
+        }
+
+        // a new smallest key strands the popped ones behind it
+        queue.insert(-1, -1);
+        queue.purge();
+        assert(queue.size() == 991);
+
+        consumer.enter();
+        size_t seen = 0;
+        for (ConcurrentSkipLists<int, int>::iterator it = queue.begin(); it != queue.end(); ++it) {
+            ++seen;
+        }
+        consumer.exit();
+        assert(seen == 991);
+        r = consumer.find(-1, v);
+        assert(r && v == -1);
+        r = consumer.find(10, v);
+        assert(r && v == 10);
+    }
+
+    cout << READERS << " consumers, spray" << endl;
+    {
+        ConcurrentSkipLists<int, int> queue;
+        std::vector<std::atomic<int> > seen(N);
+        std::vector<std::thread> consumers;
+        for (int i = 0; i < READERS; ++i) {
+            consumers.push_back(std::thread(consumer_loop, &queue, N, &seen));
+        }
+
+        // keys keep arriving while they are popped
+        for (int i = 0; i < N; ++i) {
+            queue.insert(i, i);
+        }
+        for (int i = 0; i < READERS; ++i) {
+            consumers[i].join();
+        }
+
+        for (int i = 0; i < N; ++i) {
+            assert(seen[i].load() == 1);
+        }
+        queue.purge();
+        assert(queue.size() == 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include <iostream>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "durable_skiplists.hpp"
+
+using namespace std;
+
+
+static const int WRITERS = 4;
+static const int PER_WRITER = 500;
+
+static int failing_fsync(int fd)
+{
+    errno = EIO;
+    return -1;
+}
+
+// holds the leader inside its fsync until the gate opens
+static std::atomic<bool> gate_open(false);
+static std::atomic<int> fsync_calls(0);
+
+static int gated_fsync(int fd)
+{
+    ++fsync_calls;
+    while (!gate_open) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return fdatasync(fd);
+}
+
+static void insert_one(DurableSkipLists<int, int>* skip_list, int key)
+{
+    bool r = skip_list->insert(key, -key);
+    assert(r);
+}
+
+static void writer_loop(DurableSkipLists<int, int>* skip_list, int id)
+{
+    for (int i = 0; i < PER_WRITER; ++i) {
+        int key = id * PER_WRITER + i;
+        bool r = skip_list->insert(key, -key);
+        assert(r);
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/t_durable_skiplists.%d.wal", (int)getpid());
+    unlink(path);
+
+    std::map<int, int> expected;
+    int v = -1;
+    bool r;
+
+    cout << "log and replay" << endl;
+    {
+        DurableSkipLists<int, int> skip_list(path, SYNC_NONE);
+        r = skip_list.insert(1, 2);
+        assert(!r);
+        r = skip_list.recover();
+        assert(r && skip_list.size() == 0);
+
+        srand(7);
+        for (int i = 0; i < 20000; ++i) {
+            int key = rand() % 3000;
+            if (rand() % 4) {
+                r = skip_list.insert(key, i);
+                assert(r == (expected.count(key) == 0));
+                expected[key] = i;
+            } else {
+                r = skip_list.remove(key);
+                assert(r == (expected.erase(key) == 1));
+            }
+        }
+    }
+
+    {
+        DurableSkipLists<int, int> skip_list(path, SYNC_INTERVAL, 5);
+        r = skip_list.recover();
+        assert(r && skip_list.size() == expected.size());
+        for (int key = -1; key <= 3000; ++key) {
+            r = skip_list.find(key, v);
+            assert(r == (expected.count(key) == 1));
+            assert(!r || v == expected[key]);
+        }
+
+        r = skip_list.insert(5000, 1);
+        assert(r);
+        expected[5000] = 1;
+    }
+
+    cout << "torn tail" << endl;
+    {
+        // half a record, as left by a crash in the middle of a write
+        int fd = open(path, O_WRONLY | O_APPEND);
+        assert(fd >= 0);
+        char junk[] = { WAL_INSERT, 1, 2, 3 };
+        ssize_t n = write(fd, junk, sizeof(junk));
+        assert(n == (ssize_t)sizeof(junk));
+        close(fd);
+
+        DurableSkipLists<int, int> skip_list(path);
+        r = skip_list.recover();
+        assert(r && skip_list.size() == expected.size());
+        r = skip_list.find(5000, v);
+        assert(r && v == 1);
+
+        // new records follow the last good one
+        r = skip_list.insert(5001, 2);
+        assert(r);
+        expected[5001] = 2;
+    }
+    {
+        DurableSkipLists<int, int> skip_list(path);
+        r = skip_list.recover();
+        assert(r && skip_list.size() == expected.size());
+        r = skip_list.find(5001, v);
+        assert(r && v == 2);
+    }
+    unlink(path);
+
+    cout << "background flush" << endl;
+    for (int mode = 0; mode < 2; ++mode) {
+        DurableSkipLists<int, int> skip_list(path, mode ? SYNC_INTERVAL : SYNC_NONE, 5);
+        r = skip_list.recover();
+        assert(r);
+        for (int key = 0; key < 6; ++key) {
+            r = skip_list.insert(key, key);
+            assert(r);
+        }
+
+        // no further write comes along to push the records out
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        struct stat st;
+        r = stat(path, &st) == 0;
+        assert(r && st.st_size == 6 * (off_t)(1 + 2 * sizeof(int) + sizeof(uint32_t)));
+        assert(mode ? skip_list.syncs() >= 1 : skip_list.syncs() == 0);
+        unlink(path);
+    }
+
+    cout << "failed write" << endl;
+    {
+        DurableSkipLists<int, int> skip_list(path, SYNC_COMMIT);
+        r = skip_list.recover();
+        assert(r);
+        r = skip_list.insert(1, 1);
+        assert(r);
+
+        // the log cannot grow any more: write() fails with EFBIG
+        struct stat st;
+        r = stat(path, &st) == 0;
+        assert(r);
+        struct rlimit old_limit;
+        getrlimit(RLIMIT_FSIZE, &old_limit);
+        struct rlimit limit = old_limit;
+        limit.rlim_cur = st.st_size;
+        signal(SIGXFSZ, SIG_IGN);
+        setrlimit(RLIMIT_FSIZE, &limit);
+
+        r = skip_list.insert(2, 2);
+        assert(!r);
+        r = skip_list.find(2, v);
+        assert(!r);
+        assert(!skip_list.ok() && skip_list.size() == 1);
+
+        setrlimit(RLIMIT_FSIZE, &old_limit);
+        signal(SIGXFSZ, SIG_DFL);
+    }
+    {
+        DurableSkipLists<int, int> skip_list(path);
+        r = skip_list.recover();
+        assert(r && skip_list.size() == 1);
+    }
+    unlink(path);
+
+    cout << "failed fsync" << endl;
+    {
+        DurableSkipLists<int, int> skip_list(path, SYNC_COMMIT);
+        r = skip_list.recover();
+        assert(r);
+        r = skip_list.insert(1, 1);
+        assert(r);
+
+        // the record is written but may not be on disk
+        skip_list.set_fsync(failing_fsync);
+        r = skip_list.insert(2, 2);
+        assert(!r && !skip_list.ok());
+        skip_list.set_fsync(fdatasync);
+    }
+    {
+        // and is gone from the log
+        struct stat st;
+        r = stat(path, &st) == 0;
+        assert(r && st.st_size == (off_t)(1 + 2 * sizeof(int) + sizeof(uint32_t)));
+
+        DurableSkipLists<int, int> skip_list(path);
+        r = skip_list.recover();
+        assert(r && skip_list.size() == 1);
+        r = skip_list.find(2, v);
+        assert(!r);
+    }
+    unlink(path);
+
+    cout << "group commit, " << WRITERS << " writers" << endl;
+    {
+        DurableSkipLists<int, int> skip_list(path, SYNC_COMMIT);
+        r = skip_list.recover();
+        assert(r);
+
+        std::vector<std::thread> writers;
+        for (int i = 0; i < WRITERS; ++i) {
+            writers.push_back(std::thread(writer_loop, &skip_list, i));
+        }
+        for (int i = 0; i < WRITERS; ++i) {
+            writers[i].join();
+        }
+
+        assert(skip_list.ok());
+        assert(skip_list.size() == (size_t)WRITERS * PER_WRITER);
+        cout << "fsyncs: " << skip_list.syncs() << " for " << WRITERS * PER_WRITER << " writes" << endl;
+    }
+    {
+        DurableSkipLists<int, int> skip_list(path);
+        r = skip_list.recover();
+        assert(r && skip_list.size() == (size_t)WRITERS * PER_WRITER);
+        for (int key = 0; key < WRITERS * PER_WRITER; ++key) {
+            r = skip_list.find(key, v);
+            assert(r && v == -key);
+        }
+    }
+    unlink(path);
+
+    cout << "writers waiting on a leader share its next fsync" << endl;
+    {
+        DurableSkipLists<int, int> skip_list(path, SYNC_COMMIT);
+        r = skip_list.recover();
+        assert(r);
+        skip_list.set_fsync(gated_fsync);
+
+        std::vector<std::thread> writers;
+        writers.push_back(std::thread(insert_one, &skip_list, 0));
+        while (fsync_calls < 1) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        // the leader is inside its fsync, the others queue up behind it
+        for (int i = 1; i < WRITERS; ++i) {
+            writers.push_back(std::thread(insert_one, &skip_list, i));
+        }
+        while (skip_list.logged() < (uint64_t)WRITERS) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        gate_open = true;
+        for (int i = 0; i < WRITERS; ++i) {
+            writers[i].join();
+        }
+        assert(skip_list.size() == (size_t)WRITERS);
+        assert(skip_list.syncs() == 2 && fsync_calls == 2);
+        skip_list.set_fsync(fdatasync);
+    }
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+
+#include "frozen_skiplists.hpp"
+
+using namespace std;
+
+
+// freeze a list of n even keys and probe every key around them
+static void check_size(int n)
+{
+    SkipLists<int, int> skip_list;
+    for (int i = 0; i < n; ++i) {
+        int key = (int)((long long)i * 7919 % n) * 2;
+        skip_list.insert(key, key + 1);
+    }
+
+    FrozenSkipLists<int, int> frozen = freeze(skip_list);
+    assert(frozen.size() == (size_t)n);
+
+    int expected = 0;
+    for (FrozenSkipLists<int, int>::iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        assert(it.key() == expected * 2);
+        assert(it.value() == expected * 2 + 1);
+        ++expected;
+    }
+    assert(expected == n);
+
+    for (int key = -1; key <= 2 * n; ++key) {
+        int v = -1;
+        bool r = frozen.find(key, v);
+        assert(r == (key >= 0 && key < 2 * n && key % 2 == 0));
+        assert(!r || v == key + 1);
+
+        FrozenSkipLists<int, int>::iterator lb = frozen.lower_bound(key);
+        SkipLists<int, int>::iterator live = skip_list.lower_bound(key);
+        if (live == skip_list.end()) {
+            assert(lb == frozen.end());
+        } else {
+            assert(lb != frozen.end() && lb.key() == live.key());
+        }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int sizes[] = { 0, 1, 2, 15, 16, 17, 255, 256, 257, 4096, 4097, 100000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        cout << "freeze " << sizes[i] << " keys" << endl;
+        check_size(sizes[i]);
+    }
+
+    // non-trivial keys
+    SkipLists<string, int> names;
+    names.insert("carol", 3);
+    names.insert("alice", 1);
+    names.insert("bob", 2);
+
+    FrozenSkipLists<string, int> frozen = freeze(names);
+    int v = -1;
+    bool r = frozen.find("bob", v);
+    assert(r && v == 2);
+    r = frozen.find("dave", v);
+    assert(!r);
+    assert(frozen.lower_bound("b").key() == "bob");
+    assert(frozen.lower_bound("d") == frozen.end());
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <map>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "numa_skiplists.hpp"
+
+using namespace std;
+
+
+int main(int argc, char* argv[])
+{
+    cout << numa_skiplists_nodes() << " NUMA node(s)" << endl;
+
+    // one replica per node by default
+    NumaSkipLists<int, int> local;
+    assert(local.replica_count() == numa_skiplists_nodes());
+    assert(local.local_replica() >= 0 && local.local_replica() < local.replica_count());
+
+    int v = -1;
+    bool r = local.insert(1, 2);
+    assert(r);
+    r = local.insert(3, 4);
+    assert(r);
+    r = local.insert(3, 5);
+    assert(!r);
+    local.print();
+    r = local.find(3, v);
+    assert(r && v == 5);
+    r = local.find(7, v);
+    assert(!r);
+    r = local.remove(1);
+    assert(r);
+    r = local.remove(1);
+    assert(!r);
+    assert(local.check_invariants());
+
+    cout << "sparse node ids" << endl;
+    {
+        char dir[64];
+        snprintf(dir, sizeof(dir), "/tmp/t_numa_skiplists.%d", (int)getpid());
+        const char* entries[] = { "", "/node0", "/node2", "/possible", "/node2x" };
+        for (int i = 0; i < 5; ++i) {
+            std::string path = std::string(dir) + entries[i];
+            r = mkdir(path.c_str(), 0755) == 0;
+            assert(r);
+        }
+
+        std::vector<int> ids = numa_skiplists_read_nodes(dir);
+        assert(ids.size() == 2 && ids[0] == 0 && ids[1] == 2);
+
+        NumaSkipLists<int, int> sparse(16, 0, ids);
+        assert(sparse.replica_count() == 2);
+        assert(sparse.replica_of(0) == 0 && sparse.replica_of(2) == 1);
+        assert(sparse.replica_of(1) == 0 && sparse.replica_of(7) == 0);
+
+        // fewer replicas than nodes: the nodes share them
+        NumaSkipLists<int, int> shared(16, 1, ids);
+        assert(shared.replica_of(0) == 0 && shared.replica_of(2) == 0);
+
+        for (int i = 4; i >= 0; --i) {
+            std::string path = std::string(dir) + entries[i];
+            rmdir(path.c_str());
+        }
+
+        ids = numa_skiplists_read_nodes("/nonexistent");
+        assert(ids.size() == 1 && ids[0] == 0);
+    }
+
+    cout << "3 forced replicas against std::map" << endl;
+    NumaSkipLists<int, int> skip_list(16, 3);
+    assert(skip_list.replica_count() == 3);
+    std::map<int, int> expected;
+
+    srand(3);
+    for (int i = 0; i < 100000; ++i) {
+        int key = rand() % 5000;
+        if (rand() % 3) {
+            r = skip_list.insert(key, i);
+            assert(r == (expected.count(key) == 0));
+            expected[key] = i;
+        } else {
+            r = skip_list.remove(key);
+            assert(r == (expected.erase(key) == 1));
+        }
+        if (i % 5000 == 0) {
+            assert(skip_list.check_invariants());
+        }
+    }
+    assert(skip_list.check_invariants());
+    assert(skip_list.size() == expected.size());
+
+    for (int replica = 0; replica < 3; ++replica) {
+        for (int key = -1; key <= 5000; ++key) {
+            r = skip_list.find(key, v, replica);
+            assert(r == (expected.count(key) == 1));
+            assert(!r || v == expected[key]);
+        }
+    }
+
+    for (std::map<int, int>::iterator it = expected.begin(); it != expected.end(); ++it) {
+        r = skip_list.remove(it->first);
+        assert(r);
+    }
+    assert(skip_list.size() == 0);
+    assert(skip_list.check_invariants());
+    r = skip_list.find(0, v);
+    assert(!r);
+
+    return 0;
+}
@@ -1,10 +1,21 @@
 #include <iostream>
+#include <map>
+#include <vector>
+#include <stdlib.h>
 
 #include "skiplists.hpp"
 
 using namespace std;
 
 
+static int64_t fake_now = 1000;
+
+static int64_t fake_clock()
+{
+    return fake_now;
+}
+
+
 int main(int argc, char* argv[])
 {
     SkipLists<int, int> skip_list;
@@ -64,6 +75,229 @@ int main(int argc, char* argv[])
         cout << "Deletion failure.." << endl;
     }
     skip_list.print();
-    
+
+    // past the last key
+    r = skip_list.find(7, v);
+    assert(!r);
+
+
+    cout << "deterministic 1-2-3 levels" << endl;
+    SkipLists<int, int> det_list(16, DETERMINISTIC_LEVELS);
+    std::map<int, int> expected;
+
+    // ascending inserts are the worst case for naive promotion
+    for (int i = 0; i < 1000; ++i) {
+        det_list.insert(i, i);
+        expected[i] = i;
+    }
+    assert(det_list.check_invariants());
+
+    srand(42);
+    for (int i = 0; i < 200000; ++i) {
+        int key = rand() % 5000;
+        if (rand() % 3) {
+            r = det_list.insert(key, i);
+            assert(r == (expected.count(key) == 0));
+            expected[key] = i;
+        } else {
+            r = det_list.remove(key);
+            assert(r == (expected.erase(key) == 1));
+        }
+        if (i % 1000 == 0) {
+            assert(det_list.check_invariants());
+        }
+    }
+    assert(det_list.check_invariants());
+
+    for (int key = -1; key <= 5000; ++key) {
+        r = det_list.find(key, v);
+        assert(r == (expected.count(key) == 1));
+        assert(!r || v == expected[key]);
+    }
+
+    for (std::map<int, int>::iterator it = expected.begin(); it != expected.end(); ++it) {
+        r = det_list.remove(it->first);
+        assert(r);
+    }
+    assert(det_list.check_invariants());
+    r = det_list.find(0, v);
+    assert(!r);
+
+
+    cout << "pop front" << endl;
+    SkipListsBalance modes[] = { RANDOMIZED_LEVELS, DETERMINISTIC_LEVELS };
+    for (int m = 0; m < 2; ++m) {
+        SkipLists<int, int> queue(16, modes[m]);
+        int key = -1;
+
+        r = queue.front(key, v);
+        assert(!r);
+        r = queue.pop_front(key, v);
+        assert(!r);
+
+        for (int i = 0; i < 1000; ++i) {
+            queue.insert((i * 7) % 1000, i);
+        }
+
+        r = queue.front(key, v);
+        assert(r && key == 0);
+        for (int i = 0; i < 100; ++i) {
+            r = queue.pop_front(key, v);
+            assert(r && key == i);
+        }
+        assert(queue.check_invariants());
+
+        std::vector<std::pair<int, int> > batch;
+        size_t n = queue.pop_front_batch(250, batch);
+        assert(n == 250 && batch.size() == 250);
+        for (int i = 0; i < 250; ++i) {
+            assert(batch[i].first == 100 + i);
+        }
+        assert(queue.size() == 650);
+        assert(queue.check_invariants());
+
+        n = queue.pop_front_batch(1000, batch);
+        assert(n == 650 && batch.back().first == 999);
+        assert(queue.size() == 0);
+        assert(queue.check_invariants());
+        r = queue.front(key, v);
+        assert(!r);
+    }
+
+
+    cout << "seeded tower heights" << endl;
+    {
+        SkipLists<int, int> a;
+        SkipLists<int, int> b;
+        a.seed_levels(9);
+        b.seed_levels(9);
+        bool differ = false;
+        for (int i = 0; i < 1000; ++i) {
+            int h = a.random_level();
+            assert(h >= 1 && h <= 15 && h == b.random_level());
+        }
+        b.seed_levels(10);
+        for (int i = 0; i < 1000; ++i) {
+            differ |= a.random_level() != b.random_level();
+        }
+        assert(differ);
+
+        // building a list leaves rand() alone
+        srand(1);
+        int first = rand();
+        srand(1);
+        SkipLists<int, int> c;
+        for (int i = 0; i < 100; ++i) {
+            c.insert(i, i);
+        }
+        assert(rand() == first);
+    }
+
+
+    cout << "expiring entries" << endl;
+    // only lists with TTLs carry the stamp
+    assert(sizeof(SkipListsNode<int, int>) + sizeof(int64_t) == sizeof(SkipListsNode<int, int, true>));
+    for (int m = 0; m < 2; ++m) {
+        SkipLists<int, int, true> cache(16, modes[m]);
+        cache.set_clock(fake_clock);
+
+        for (int i = 0; i < 1000; ++i) {
+            // keys below 500 expire at 1000 + 10 .. 1000 + 500
+            if (i < 500) {
+                cache.insert(i, i, 10 + i);
+            } else {
+                cache.insert(i, i);
+            }
+        }
+        assert(cache.check_invariants());
+
+        fake_now = 1000 + 100;
+        // 0 .. 90 are gone, found lazily
+        r = cache.find(50, v);
+        assert(!r);
+        assert(cache.size() == 999);
+        r = cache.find(95, v);
+        assert(r && v == 95);
+
+        // size() still counts them, iteration does not
+        assert(cache.begin().key() == 91);
+        assert(cache.lower_bound(10).key() == 91);
+        size_t seen = 0;
+        for (SkipLists<int, int, true>::iterator it = cache.begin(); it != cache.end(); ++it) {
+            ++seen;
+        }
+        assert(seen == 909);
+
+        // refreshing a TTL or clearing it
+        r = cache.insert(95, -95, 1000);
+        assert(!r);
+        r = cache.insert(96, -96);
+        assert(!r);
+
+        size_t n = cache.evict_expired(40);
+        assert(n == 40);
+        assert(cache.check_invariants());
+        n = cache.evict_expired(1000);
+        assert(n == 50);
+        assert(cache.size() == 909);
+
+        fake_now = 1000 + 600;
+        // popping skips what expired meanwhile
+        int key = -1;
+        r = cache.pop_front(key, v);
+        assert(r && key == 95 && v == -95);
+        r = cache.pop_front(key, v);
+        assert(r && key == 96);
+        assert(cache.check_invariants());
+
+        n = cache.evict_expired(1000);
+        assert(n == 403);
+        assert(cache.size() == 500);
+        assert(cache.check_invariants());
+
+        // an expired key comes back as a new insert
+        cache.insert(2000, 1, 5);
+        fake_now += 10;
+        r = cache.insert(2000, 2);
+        assert(r);
+        r = cache.find(2000, v);
+        assert(r && v == 2);
+        assert(cache.check_invariants());
+        fake_now = 1000;
+    }
+
+
+    cout << "batched inserts" << endl;
+    for (int m = 0; m < 2; ++m) {
+        SkipLists<int, int> bulk(16, modes[m]);
+        bulk.insert(5, -5);
+
+        // ascending, a repeated key, then a step back
+        std::vector<std::pair<int, int> > items;
+        for (int i = 0; i < 2000; i += 2) {
+            items.push_back(std::make_pair(i, i));
+        }
+        items.push_back(std::make_pair(1998, 7));
+        for (int i = 1; i < 100; i += 2) {
+            items.push_back(std::make_pair(i, i));
+        }
+
+        size_t n = bulk.insert_batch(items);
+        assert(n == 1000 + 49);
+        assert(bulk.size() == 1050);
+        assert(bulk.check_invariants());
+
+        r = bulk.find(5, v);
+        assert(r && v == 5);
+        r = bulk.find(1998, v);
+        assert(r && v == 7);
+        r = bulk.find(101, v);
+        assert(!r);
+        for (int i = 0; i < 100; ++i) {
+            r = bulk.find(i, v);
+            assert(r && v == i);
+        }
+    }
+
     return 0;
 }